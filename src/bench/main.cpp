@@ -0,0 +1,1466 @@
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <cstdint>
+#include <cstdlib>
+
+#include "texture_atlas.h"
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * Measures the cost of id based queries as the number of virtual textures
+ * grows. Query cost should stay flat regardless of vtex count.
+ */
+static void bench_lookup()
+{
+    const int queries = 1 << 20;
+
+    for (int count = 1024; count <= 32768; count *= 2)
+    {
+        Atlas *atlas = NULL;
+        if (!atlas_create(&atlas, 8192, 0))
+        {
+            std::cerr << "Atlas creation failed.\n";
+            return;
+        }
+
+        std::vector<uint32_t> ids(count);
+        for (auto &id : ids)
+            atlas_gen_texture(atlas, &id);
+
+        std::mt19937 rng(count);
+        std::uniform_int_distribution<int> pick(0, count - 1);
+        std::vector<uint32_t> order(queries);
+        for (auto &id : order)
+            id = ids[pick(rng)];
+
+        uint16_t xywh[4];
+        uint32_t checksum = 0;
+        auto start = Clock::now();
+        for (auto id : order)
+        {
+            atlas_get_vtex_xywh_coords(atlas, id, 1, &xywh[0]);
+            checksum += xywh[0];
+        }
+        auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+        std::cout << "lookup vtex_count=" << count
+                  << " ns/op=" << elapsed / queries
+                  << " (checksum " << checksum << ")\n";
+        atlas_destroy(atlas);
+    }
+}
+
+/**
+ * Measures allocation throughput while filling an atlas page with randomly
+ * sized textures, reported per fill level since hole count grows with it.
+ */
+static void bench_allocate()
+{
+    const int steps = 4;
+
+    for (int dims = 512; dims <= 2048; dims *= 2)
+    {
+        Atlas *atlas = NULL;
+        if (!atlas_create(&atlas, dims, 1))
+        {
+            std::cerr << "Atlas creation failed.\n";
+            return;
+        }
+
+        std::mt19937 rng(dims);
+        std::uniform_int_distribution<int> size(4, 48);
+        double page_area = (double)dims * dims, used_area = 0;
+        int allocated = 0, failed = 0;
+
+        for (int step = 1; step <= steps; step++)
+        {
+            double target = page_area * 0.2 * step;
+            int count = 0;
+
+            auto start = Clock::now();
+            while (used_area < target && failed < 64)
+            {
+                uint32_t id;
+                int w = size(rng), h = size(rng);
+                atlas_gen_texture(atlas, &id);
+                if (atlas_allocate_vtex_space(atlas, id, w, h))
+                    used_area += (w + 2) * (h + 2);
+                else
+                    failed++;
+                count++;
+            }
+            auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+            allocated += count;
+            std::cout << "allocate dims=" << dims
+                      << " fill=" << (int)(100 * used_area / page_area) << "%"
+                      << " allocations=" << allocated
+                      << " ns/op=" << (count ? elapsed / count : 0) << "\n";
+        }
+
+        atlas_destroy(atlas);
+    }
+}
+
+/**
+ * Packing backends to compare, in AtlasBackend order.
+ */
+static const std::pair<const char *, AtlasBackend> backends[] = {
+    {"maxrects", ATLAS_BACKEND_MAXRECTS},
+    {"skyline", ATLAS_BACKEND_SKYLINE},
+    {"guillotine", ATLAS_BACKEND_GUILLOTINE},
+    {"shelf", ATLAS_BACKEND_SHELF},
+    {"buddy", ATLAS_BACKEND_BUDDY},
+};
+
+/**
+ * Measures alloc/free churn: fill an atlas page up to a given occupancy, then
+ * repeatedly destroy a random texture and allocate a new one in its place.
+ */
+static void bench_churn()
+{
+    const int dims = 2048, cycles = 2000;
+
+    for (auto &backend : backends)
+    {
+        for (int fill : {50, 75, 90})
+        {
+            AtlasOptions options = {};
+            options.dimensions = dims;
+            options.padding = 1;
+            options.backend = backend.second;
+            Atlas *atlas = NULL;
+            if (!atlas_create_ex(&atlas, &options))
+            {
+                std::cerr << "Atlas creation failed.\n";
+                return;
+            }
+
+            std::mt19937 rng(fill);
+            std::uniform_int_distribution<int> size(4, 48);
+            std::vector<uint32_t> live;
+            double target = (double)dims * dims * fill / 100, used_area = 0;
+            int failed = 0;
+
+            while (used_area < target && failed < 64)
+            {
+                uint32_t id;
+                int w = size(rng), h = size(rng);
+                atlas_gen_texture(atlas, &id);
+                if (atlas_allocate_vtex_space(atlas, id, w, h))
+                {
+                    used_area += (w + 2) * (h + 2);
+                    live.push_back(id);
+                }
+                else
+                {
+                    atlas_destroy_vtex(atlas, id);
+                    failed++;
+                }
+            }
+
+            failed = 0;
+            auto start = Clock::now();
+            for (int i = 0; i < cycles; i++)
+            {
+                auto victim = live.begin() + rng() % live.size();
+                atlas_destroy_vtex(atlas, *victim);
+
+                uint32_t id;
+                atlas_gen_texture(atlas, &id);
+                if (atlas_allocate_vtex_space(atlas, id, size(rng), size(rng)))
+                {
+                    *victim = id;
+                }
+                else
+                {
+                    atlas_destroy_vtex(atlas, id);
+                    *victim = live.back();
+                    live.pop_back();
+                    failed++;
+                }
+            }
+            auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+            std::cout << "churn backend=" << backend.first
+                      << " dims=" << dims
+                      << " fill=" << fill << "%"
+                      << " live=" << live.size()
+                      << " failed=" << failed
+                      << " ns/cycle=" << elapsed / cycles << "\n";
+            atlas_destroy(atlas);
+        }
+    }
+}
+
+/**
+ * Compares packing backends by filling a page with glyph-like textures until
+ * allocations start failing, reporting time per allocation and occupancy.
+ */
+static void bench_backends()
+{
+    const int dims = 2048;
+
+    for (auto &backend : backends)
+    {
+        AtlasOptions options = {};
+        options.dimensions = dims;
+        options.padding = 1;
+        options.backend = backend.second;
+        Atlas *atlas = NULL;
+        if (!atlas_create_ex(&atlas, &options))
+        {
+            std::cerr << "Atlas creation failed.\n";
+            return;
+        }
+
+        std::mt19937 rng(dims);
+        std::uniform_int_distribution<int> width(6, 32), height(18, 24);
+        double used_area = 0;
+        int count = 0, failed = 0;
+
+        auto start = Clock::now();
+        while (failed < 64)
+        {
+            uint32_t id;
+            int w = width(rng), h = height(rng);
+            atlas_gen_texture(atlas, &id);
+            if (atlas_allocate_vtex_space(atlas, id, w, h))
+                used_area += (w + 2) * (h + 2);
+            else
+                failed++;
+            count++;
+        }
+        auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+        std::cout << "backends backend=" << backend.first
+                  << " allocations=" << count
+                  << " occupancy=" << (int)(100 * used_area / ((double)dims * dims)) << "%"
+                  << " ns/op=" << elapsed / count << "\n";
+        atlas_destroy(atlas);
+    }
+}
+
+/**
+ * Fills an unpadded page with power-of-two textures, 16 to 256 texels per
+ * side with 2:1 and 1:2 aspects, then frees and refills half of them.
+ */
+static void bench_pot()
+{
+    const int dims = 4096;
+    const int cycles = 20000;
+
+    for (auto &backend : backends)
+    {
+        AtlasOptions options = {};
+        options.dimensions = dims;
+        options.padding = 0;
+        options.backend = backend.second;
+        Atlas *atlas = NULL;
+        if (!atlas_create_ex(&atlas, &options))
+        {
+            std::cerr << "Atlas creation failed.\n";
+            return;
+        }
+
+        std::mt19937 rng(dims);
+        std::uniform_int_distribution<int> side(4, 8), aspect(-1, 1);
+        std::vector<uint32_t> live;
+        int count = 0;
+
+        auto allocate = [&]()
+        {
+            uint32_t id;
+            int w = 1 << side(rng), h = w;
+            int a = aspect(rng);
+            if (a < 0)
+                w /= 2;
+            else if (a > 0)
+                h /= 2;
+
+            atlas_gen_texture(atlas, &id);
+            count++;
+            if (!atlas_allocate_vtex_space(atlas, id, w, h))
+            {
+                atlas_destroy_vtex(atlas, id);
+                return false;
+            }
+            live.push_back(id);
+            return true;
+        };
+
+        auto start = Clock::now();
+        while (allocate())
+            ;
+        for (int i = 0; i < cycles; i++)
+        {
+            std::uniform_int_distribution<size_t> pick(0, live.size() - 1);
+            size_t victim = pick(rng);
+            atlas_destroy_vtex(atlas, live[victim]);
+            live[victim] = live.back();
+            live.pop_back();
+            count++;
+            allocate();
+        }
+        auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+        AtlasStats stats;
+        atlas_get_stats(atlas, &stats);
+        std::cout << "pot backend=" << backend.first
+                  << " live=" << stats.vtex_count
+                  << " occupancy=" << (int)(100 * (double)stats.used_area / ((double)dims * dims)) << "%"
+                  << " wasted=" << (int)(100 * (double)stats.wasted_area / ((double)dims * dims)) << "%"
+                  << " ns/op=" << elapsed / count << "\n";
+        atlas_destroy(atlas);
+    }
+}
+
+/**
+ * Reads the dimensions of a PNG or JPEG image from its header.
+ */
+static bool image_size(const std::string &path, int &w, int &h)
+{
+    std::ifstream file(path, std::ios::binary);
+    unsigned char header[24];
+    if (!file.read((char *)header, sizeof(header)))
+        return false;
+
+    // PNG, the IHDR chunk always comes first.
+    if (header[0] == 0x89 && header[1] == 'P' && header[2] == 'N' && header[3] == 'G')
+    {
+        w = (header[16] << 24) | (header[17] << 16) | (header[18] << 8) | header[19];
+        h = (header[20] << 24) | (header[21] << 16) | (header[22] << 8) | header[23];
+        return true;
+    }
+
+    // JPEG, walk the markers up to the start of frame.
+    if (header[0] != 0xFF || header[1] != 0xD8)
+        return false;
+
+    file.seekg(2);
+    unsigned char marker[9];
+    while (file.read((char *)marker, 4) && marker[0] == 0xFF)
+    {
+        int length = (marker[2] << 8) | marker[3];
+        if (marker[1] >= 0xC0 && marker[1] <= 0xCF && marker[1] != 0xC4 && marker[1] != 0xC8 && marker[1] != 0xCC)
+        {
+            if (!file.read((char *)marker + 4, 5))
+                return false;
+            h = (marker[5] << 8) | marker[6];
+            w = (marker[7] << 8) | marker[8];
+            return true;
+        }
+        file.seekg(length - 2, std::ios::cur);
+    }
+
+    return false;
+}
+
+/**
+ * Packs the Sponza textures, with their mip chains down to 16x16, into as
+ * many pages as needed, for each heuristic over the holes array. Pages are
+ * filled first-fit, in scene file order.
+ */
+static void bench_density()
+{
+    const std::string path = "data/sponza/";
+    const int dims = 4096, padding = 16;
+
+    std::vector<std::string> files;
+    std::error_code error;
+    for (auto &entry : std::filesystem::directory_iterator(path, error))
+        files.push_back(entry.path().string());
+    std::sort(files.begin(), files.end());
+
+    std::vector<std::pair<int, int>> sizes;
+    for (auto &file : files)
+    {
+        int w, h;
+        if (!image_size(file, w, h))
+            continue;
+        for (; w >= 16 && h >= 16; w /= 2, h /= 2)
+            sizes.emplace_back(w, h);
+    }
+
+    if (sizes.empty())
+    {
+        std::cerr << "No textures found in '" << path << "', run from the repository root.\n";
+        return;
+    }
+
+    static const std::pair<const char *, AtlasHeuristic> heuristics[] = {
+        {"best-area", ATLAS_HEURISTIC_BEST_AREA},
+        {"best-short-side", ATLAS_HEURISTIC_BEST_SHORT_SIDE},
+        {"best-long-side", ATLAS_HEURISTIC_BEST_LONG_SIDE},
+        {"bottom-left", ATLAS_HEURISTIC_BOTTOM_LEFT},
+        {"contact-point", ATLAS_HEURISTIC_CONTACT_POINT},
+    };
+
+    for (auto &backend : {backends[0], backends[2]})
+    {
+        for (auto &heuristic : heuristics)
+        {
+            for (uint32_t flags : {0u, (uint32_t)ATLAS_ALLOCATE_ROTATE})
+            {
+                AtlasOptions options = {};
+                options.dimensions = dims;
+                options.padding = padding;
+                options.backend = backend.second;
+                options.heuristic = heuristic.second;
+                options.max_pages = 64;
+                options.page_order = ATLAS_PAGES_FIRST_FIT;
+                Atlas *atlas = NULL;
+                if (!atlas_create_ex(&atlas, &options))
+                {
+                    std::cerr << "Atlas creation failed.\n";
+                    return;
+                }
+
+                std::vector<uint32_t> ids;
+                double used_area = 0;
+                bool failed = false;
+
+                auto start = Clock::now();
+                for (auto &size : sizes)
+                {
+                    uint32_t id;
+                    atlas_gen_texture(atlas, &id);
+                    ids.push_back(id);
+                    failed |= !atlas_allocate_vtex_space_ex(atlas, id, size.first, size.second, flags);
+                    used_area += (double)size.first * size.second;
+                }
+                auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+                // With equal page counts, the emptier the last page the better.
+                int pages = atlas_get_page_count(atlas);
+                double last_area = 0;
+                for (size_t i = 0; i < ids.size(); i++)
+                {
+                    uint16_t page;
+                    if (atlas_get_vtex_page(atlas, ids[i], &page) && page == pages - 1)
+                        last_area += (double)sizes[i].first * sizes[i].second;
+                }
+
+                std::cout << "density backend=" << backend.first
+                          << " heuristic=" << heuristic.first
+                          << " rotate=" << (flags ? 1 : 0)
+                          << " textures=" << sizes.size()
+                          << " pages=" << pages
+                          << " occupancy=" << (int)(100 * used_area / ((double)dims * dims * pages)) << "%"
+                          << " last_page=" << (int)(100 * last_area / ((double)dims * dims)) << "%"
+                          << " ns/op=" << elapsed / sizes.size()
+                          << (failed ? " (some textures exceed a page)" : "") << "\n";
+                atlas_destroy(atlas);
+            }
+        }
+    }
+}
+
+/**
+ * Places the same oversized set of randomly sized textures on one page, in
+ * arrival order and batched under each sort order, and reports how much of
+ * the set fits.
+ */
+static void bench_batch()
+{
+    const int dims = 2048;
+    const int count = 512;
+
+    static const std::pair<const char *, AtlasSortOrder> orders[] = {
+        {"none", ATLAS_SORT_NONE},
+        {"max-side", ATLAS_SORT_MAX_SIDE},
+        {"area", ATLAS_SORT_AREA},
+        {"perimeter", ATLAS_SORT_PERIMETER},
+    };
+
+    std::mt19937 rng(dims);
+    std::uniform_int_distribution<int> side(16, 256);
+    std::vector<uint16_t> wh;
+    for (int i = 0; i < count * 2; i++)
+        wh.push_back((uint16_t)side(rng));
+
+    for (auto &order : orders)
+    {
+        Atlas *atlas = NULL;
+        if (!atlas_create(&atlas, dims, 1))
+        {
+            std::cerr << "Atlas creation failed.\n";
+            return;
+        }
+
+        std::vector<uint32_t> ids(count);
+        std::vector<uint8_t> results(count);
+        for (auto &id : ids)
+            atlas_gen_texture(atlas, &id);
+
+        auto start = Clock::now();
+        atlas_allocate_batch(atlas, ids.data(), wh.data(), count, order.second, results.data());
+        auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+        int placed = 0;
+        for (uint8_t result : results)
+            placed += result;
+
+        AtlasStats stats;
+        atlas_get_stats(atlas, &stats);
+        std::cout << "batch order=" << order.first
+                  << " placed=" << placed << "/" << count
+                  << " occupancy=" << (int)(100 * (double)stats.used_area / ((double)dims * dims)) << "%"
+                  << " ns/op=" << elapsed / count << "\n";
+        atlas_destroy(atlas);
+    }
+}
+
+/**
+ * Runs millions of gen/allocate/destroy cycles of glyph sized textures on
+ * every backend, like a long running glyph cache would, so slots get reused
+ * through many generations. Checks the atlas still reports the exact area of
+ * live textures, and refuses to place a live texture a second time.
+ */
+static void bench_soak()
+{
+    const int dims = 2048;
+    const int cycles = 1 << 21;
+    const size_t target = 4096;
+
+    for (auto &backend : backends)
+    {
+        AtlasOptions options = {};
+        options.dimensions = dims;
+        options.padding = 1;
+        options.backend = backend.second;
+        Atlas *atlas = NULL;
+        if (!atlas_create_ex(&atlas, &options))
+        {
+            std::cerr << "Atlas creation failed.\n";
+            return;
+        }
+
+        std::mt19937 rng(dims);
+        std::uniform_int_distribution<int> width(6, 32), height(18, 24);
+        std::vector<std::pair<uint32_t, uint64_t>> live;
+        uint64_t live_area = 0;
+        uint32_t last_id = 0;
+        int failed = 0, replaced = 0;
+
+        auto start = Clock::now();
+        for (int i = 0; i < cycles; i++)
+        {
+            if (live.size() >= target || (!live.empty() && rng() % 2))
+            {
+                std::uniform_int_distribution<size_t> pick(0, live.size() - 1);
+                size_t victim = pick(rng);
+                atlas_destroy_vtex(atlas, live[victim].first);
+                live_area -= live[victim].second;
+                live[victim] = live.back();
+                live.pop_back();
+                continue;
+            }
+
+            int w = width(rng), h = height(rng);
+            if (!atlas_gen_texture(atlas, &last_id))
+                break;
+            if (!atlas_allocate_vtex_space(atlas, last_id, w, h))
+            {
+                atlas_destroy_vtex(atlas, last_id);
+                failed++;
+                continue;
+            }
+
+            uint64_t area = (uint64_t)(w + 2) * (h + 2);
+            live.emplace_back(last_id, area);
+            live_area += area;
+            if (i % 64 == 0 && atlas_allocate_vtex_space(atlas, last_id, w, h))
+                replaced++;
+        }
+        auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+        AtlasStats stats;
+        atlas_get_stats(atlas, &stats);
+        std::cout << "soak backend=" << backend.first
+                  << " cycles=" << cycles
+                  << " last_id=" << last_id
+                  << " live=" << stats.vtex_count
+                  << " failed=" << failed
+                  << " ns/op=" << elapsed / cycles
+                  << (stats.used_area == live_area && stats.vtex_count == live.size() ? "" : " (stats mismatch)")
+                  << (replaced ? " (placed twice)" : "")
+                  << "\n";
+        atlas_destroy(atlas);
+    }
+}
+
+/**
+ * Runs loader-like threads, each generating, allocating, querying and
+ * destroying its own glyph sized textures on a shared multi-page atlas.
+ * Compares a global lock around a plain atlas, a concurrent atlas, and a
+ * concurrent atlas where every thread packs into arenas of its own.
+ */
+static void bench_threads()
+{
+    const int dims = 1024, arena_dims = 256, cycles = 20000, queries = 8;
+    const size_t target = 256;
+
+    for (const char *mode : {"mutex", "concurrent", "arena"})
+    {
+        bool concurrent = std::string(mode) != "mutex", arenas = std::string(mode) == "arena";
+        double single = 0;
+        for (int threads = 1; threads <= 32; threads *= 2)
+        {
+            AtlasOptions options = {};
+            options.dimensions = dims;
+            options.padding = 1;
+            options.backend = ATLAS_BACKEND_GUILLOTINE;
+            options.heuristic = ATLAS_HEURISTIC_BEST_AREA;
+            options.max_pages = 64;
+            options.page_order = ATLAS_PAGES_FIRST_FIT;
+            options.concurrent = concurrent;
+            Atlas *atlas = NULL;
+            if (!atlas_create_ex(&atlas, &options))
+            {
+                std::cerr << "Atlas creation failed.\n";
+                return;
+            }
+
+            std::mutex lock;
+            auto guarded = [&](auto &&call)
+            {
+                if (concurrent)
+                    return call();
+                std::lock_guard<std::mutex> guard(lock);
+                return call();
+            };
+
+            auto worker = [&](int seed)
+            {
+                std::mt19937 rng(seed);
+                std::uniform_int_distribution<int> width(6, 32), height(18, 24);
+                std::vector<uint32_t> live;
+                AtlasArena *arena = NULL;
+                auto allocate = [&](uint32_t id, int w, int h)
+                {
+                    if (!arenas)
+                        return guarded([&] { return atlas_allocate_vtex_space(atlas, id, w, h); });
+
+                    // Retire full arenas, leftover space goes back to their page.
+                    if (arena && atlas_arena_allocate(arena, id, w, h))
+                        return 1;
+                    if (arena)
+                        atlas_arena_retire(arena);
+                    if (!atlas_arena_create(atlas, arena_dims, &arena))
+                    {
+                        arena = NULL;
+                        return 0;
+                    }
+                    return atlas_arena_allocate(arena, id, w, h);
+                };
+
+                for (int i = 0; i < cycles; i++)
+                {
+                    for (int q = 0; q < queries && !live.empty(); q++)
+                    {
+                        uint16_t xywh[4];
+                        uint32_t id = live[rng() % live.size()];
+                        guarded([&] { return atlas_get_vtex_xywh_coords(atlas, id, 0, xywh); });
+                    }
+
+                    if (live.size() >= target || (!live.empty() && rng() % 2))
+                    {
+                        size_t victim = rng() % live.size();
+                        guarded([&] { return atlas_destroy_vtex(atlas, live[victim]); });
+                        live[victim] = live.back();
+                        live.pop_back();
+                        continue;
+                    }
+
+                    uint32_t id;
+                    int w = width(rng), h = height(rng);
+                    if (!guarded([&] { return atlas_gen_texture(atlas, &id); }))
+                        continue;
+                    if (allocate(id, w, h))
+                        live.push_back(id);
+                    else
+                        guarded([&] { return atlas_destroy_vtex(atlas, id); });
+                }
+
+                if (arena)
+                    atlas_arena_retire(arena);
+            };
+
+            auto start = Clock::now();
+            std::vector<std::thread> pool;
+            for (int t = 0; t < threads; t++)
+                pool.emplace_back(worker, t + 1);
+            for (auto &thread : pool)
+                thread.join();
+            auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+            double ops = (double)threads * cycles / elapsed;
+            if (threads == 1)
+                single = ops;
+
+            std::cout << "threads mode=" << mode
+                      << " threads=" << threads
+                      << " pages=" << atlas_get_page_count(atlas)
+                      << " cycles/s=" << ops
+                      << " speedup=" << ops / single << "\n";
+            atlas_destroy(atlas);
+        }
+    }
+}
+
+/**
+ * Fills every page of an atlas with glyph sized textures, and then frees most
+ * of them at random, leaving free space scattered in small holes.
+ */
+static void fragment_atlas(Atlas *atlas)
+{
+    std::mt19937 rng(atlas_get_dimensions(atlas));
+    std::uniform_int_distribution<int> width(6, 32), height(18, 24);
+    std::vector<uint32_t> live;
+    for (int failed = 0; failed < 64;)
+    {
+        uint32_t id;
+        atlas_gen_texture(atlas, &id);
+        if (atlas_allocate_vtex_space(atlas, id, width(rng), height(rng)))
+            live.push_back(id);
+        else
+        {
+            atlas_destroy_vtex(atlas, id);
+            failed++;
+        }
+    }
+    for (auto id : live)
+    {
+        if (rng() % 10 < 6)
+            atlas_destroy_vtex(atlas, id);
+    }
+}
+
+/**
+ * Counts how many textures of a given size still fit in an atlas.
+ */
+static int count_fitting(Atlas *atlas, int size)
+{
+    int fitted = 0;
+    for (uint32_t id; atlas_gen_texture(atlas, &id) && atlas_allocate_vtex_space(atlas, id, size, size);)
+        fitted++;
+    return fitted;
+}
+
+/**
+ * Fragments an atlas and counts how many large textures still fit with and
+ * without defragmenting.
+ */
+static void bench_defrag()
+{
+    const int dims = 1024, pages = 4, large = 64;
+
+    for (auto &backend : backends)
+    {
+        for (bool defrag : {false, true})
+        {
+            AtlasOptions options = {};
+            options.dimensions = dims;
+            options.padding = 1;
+            options.backend = backend.second;
+            options.heuristic = ATLAS_HEURISTIC_BEST_AREA;
+            options.max_pages = pages;
+            Atlas *atlas = NULL;
+            if (!atlas_create_ex(&atlas, &options))
+            {
+                std::cerr << "Atlas creation failed.\n";
+                return;
+            }
+
+            fragment_atlas(atlas);
+
+            AtlasStats stats;
+            atlas_get_stats(atlas, &stats);
+            std::vector<AtlasMove> moves(stats.vtex_count);
+            size_t move_count = 0;
+            uint64_t texels = 0;
+            auto start = Clock::now();
+            if (defrag)
+                atlas_defragment(atlas, 0, moves.data(), moves.size(), &move_count);
+            auto elapsed = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            for (size_t i = 0; i < move_count; i++)
+                texels += (uint64_t)moves[i].new_xywh[2] * moves[i].new_xywh[3];
+
+            atlas_get_stats(atlas, &stats);
+            int fitted = count_fitting(atlas, large);
+
+            std::cout << "defrag backend=" << backend.first
+                      << " defragmented=" << (defrag ? "yes" : "no")
+                      << " moves=" << move_count
+                      << " texels=" << texels
+                      << " ms=" << elapsed
+                      << " fragmentation=" << stats.fragmentation
+                      << " fitted_" << large << "x" << large << "=" << fitted << "\n";
+            atlas_destroy(atlas);
+        }
+    }
+}
+
+/**
+ * Fragments an atlas and runs one budgeted compaction step per frame,
+ * reporting step times and how many large textures fit afterwards.
+ */
+static void bench_compact()
+{
+    const int dims = 1024, pages = 4, large = 64, frames = 2000;
+    const uint64_t budget = 4096;
+
+    for (auto &backend : backends)
+    {
+        AtlasOptions options = {};
+        options.dimensions = dims;
+        options.padding = 1;
+        options.backend = backend.second;
+        options.heuristic = ATLAS_HEURISTIC_BEST_AREA;
+        options.max_pages = pages;
+        Atlas *atlas = NULL;
+        if (!atlas_create_ex(&atlas, &options))
+        {
+            std::cerr << "Atlas creation failed.\n";
+            return;
+        }
+
+        fragment_atlas(atlas);
+
+        std::vector<double> steps;
+        AtlasMove moves[64];
+        size_t total = 0;
+        for (int frame = 0; frame < frames; frame++)
+        {
+            size_t move_count;
+            auto start = Clock::now();
+            atlas_compact_step(atlas, budget, moves, 64, &move_count);
+            steps.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+            total += move_count;
+        }
+
+        std::sort(steps.begin(), steps.end());
+        double mean = 0;
+        for (double step : steps)
+            mean += step / frames;
+
+        std::cout << "compact backend=" << backend.first
+                  << " frames=" << frames
+                  << " moves=" << total
+                  << " us/step=" << mean
+                  << " p99=" << steps[frames * 99 / 100]
+                  << " max=" << steps.back()
+                  << " fitted_" << large << "x" << large << "=" << count_fitting(atlas, large) << "\n";
+        atlas_destroy(atlas);
+    }
+}
+
+/**
+ * Measures how long statistics take on a fragmented atlas, and reports them.
+ */
+static void bench_stats()
+{
+    const int dims = 1024, pages = 4, calls = 1000;
+
+    for (auto &backend : backends)
+    {
+        AtlasOptions options = {};
+        options.dimensions = dims;
+        options.padding = 1;
+        options.backend = backend.second;
+        options.heuristic = ATLAS_HEURISTIC_BEST_AREA;
+        options.max_pages = pages;
+        Atlas *atlas = NULL;
+        if (!atlas_create_ex(&atlas, &options))
+        {
+            std::cerr << "Atlas creation failed.\n";
+            return;
+        }
+
+        fragment_atlas(atlas);
+
+        AtlasStats stats;
+        auto start = Clock::now();
+        for (int i = 0; i < calls; i++)
+            atlas_get_stats(atlas, &stats);
+        auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+        std::cout << "stats backend=" << backend.first
+                  << " live=" << stats.vtex_count
+                  << " padding=" << (int)(100 * (double)stats.padding_area / stats.used_area) << "%"
+                  << " holes=" << stats.hole_count
+                  << " largest=" << stats.largest_free[0] << "x" << stats.largest_free[1]
+                  << " fragmentation=" << stats.fragmentation
+                  << " ns/call=" << elapsed / calls << "\n";
+        atlas_destroy(atlas);
+    }
+}
+
+/**
+ * Texture sizes drawn by the synthetic workloads.
+ */
+using SizeGenerator = std::pair<int, int> (*)(std::mt19937 &rng);
+
+static std::pair<int, int> glyph_size(std::mt19937 &rng)
+{
+    std::uniform_int_distribution<int> width(6, 16), height(18, 20);
+    return {width(rng), height(rng)};
+}
+
+static std::pair<int, int> pot_size(std::mt19937 &rng)
+{
+    std::uniform_int_distribution<int> level(4, 8), aspect(-1, 1);
+    int side = 1 << level(rng), skew = aspect(rng);
+    return {skew < 0 ? side / 2 : side, skew > 0 ? side / 2 : side};
+}
+
+static std::pair<int, int> sprite_size(std::mt19937 &rng)
+{
+    // Pareto distributed sides, mostly small sprites and a few huge ones.
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    auto side = [&] { return (int)std::min(512.0, 8.0 / std::pow(1.0 - uniform(rng), 1.0 / 1.2)); };
+    return {side(), side()};
+}
+
+static std::pair<int, int> mixed_size(std::mt19937 &rng)
+{
+    std::uniform_int_distribution<int> size(4, 48);
+    return {size(rng), size(rng)};
+}
+
+/**
+ * Synthetic workload, either filling a page until allocations keep failing,
+ * or filling it up to a given occupancy and then churning through it.
+ */
+struct Workload
+{
+    const char *name;
+    SizeGenerator size;
+    uint16_t padding;
+    int fill; // Occupancy to churn at, in percent, 0 to fill the page.
+};
+
+static const Workload workloads[] = {
+    {"glyphs", glyph_size, 1, 0},
+    {"pot", pot_size, 0, 0},
+    {"sprites", sprite_size, 1, 0},
+    {"churn_50", mixed_size, 1, 50},
+    {"churn_75", mixed_size, 1, 75},
+    {"churn_90", mixed_size, 1, 90},
+};
+
+/**
+ * Runs every synthetic workload on every backend, timing each operation,
+ * and prints one JSON object per line with mean, p50, p99 and worst
+ * latencies along with the final occupancy. Fill workloads time each
+ * allocation, churn workloads each destroy and allocate pair.
+ */
+static void bench_workloads()
+{
+    const int dims = 2048, cycles = 20000, max_failures = 64;
+
+    for (auto &workload : workloads)
+    {
+        for (auto &backend : backends)
+        {
+            AtlasOptions options = {};
+            options.dimensions = dims;
+            options.padding = workload.padding;
+            options.backend = backend.second;
+            Atlas *atlas = NULL;
+            if (!atlas_create_ex(&atlas, &options))
+            {
+                std::cerr << "Atlas creation failed.\n";
+                return;
+            }
+
+            std::mt19937 rng(dims);
+            std::vector<uint32_t> live;
+            std::vector<double> latencies;
+            double target = (double)dims * dims * (workload.fill ? workload.fill : 100) / 100;
+            int failed = 0;
+
+            auto allocate = [&]() {
+                uint32_t id;
+                auto size = workload.size(rng);
+                atlas_gen_texture(atlas, &id);
+
+                auto start = Clock::now();
+                int success = atlas_allocate_vtex_space(atlas, id, size.first, size.second);
+                double elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+                if (success)
+                    live.push_back(id);
+                else
+                    atlas_destroy_vtex(atlas, id);
+                failed += !success;
+                return elapsed;
+            };
+
+            AtlasStats stats;
+            for (stats.used_area = 0; stats.used_area < target && failed < max_failures;)
+            {
+                double elapsed = allocate();
+                if (!workload.fill)
+                    latencies.push_back(elapsed);
+                atlas_get_stats(atlas, &stats);
+            }
+
+            if (workload.fill)
+            {
+                failed = 0;
+                for (int i = 0; i < cycles && !live.empty(); i++)
+                {
+                    size_t victim = rng() % live.size();
+                    auto start = Clock::now();
+                    atlas_destroy_vtex(atlas, live[victim]);
+                    double elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+                    live[victim] = live.back();
+                    live.pop_back();
+                    latencies.push_back(elapsed + allocate());
+                }
+            }
+
+            atlas_get_stats(atlas, &stats);
+            std::sort(latencies.begin(), latencies.end());
+            double mean = 0;
+            for (double latency : latencies)
+                mean += latency / latencies.size();
+
+            std::cout << "{\"bench\": \"workloads\""
+                      << ", \"workload\": \"" << workload.name << "\""
+                      << ", \"backend\": \"" << backend.first << "\""
+                      << ", \"dims\": " << dims
+                      << ", \"ops\": " << latencies.size()
+                      << ", \"failed\": " << failed
+                      << ", \"ns_per_op\": " << mean
+                      << ", \"p50_ns\": " << latencies[latencies.size() / 2]
+                      << ", \"p99_ns\": " << latencies[latencies.size() * 99 / 100]
+                      << ", \"max_ns\": " << latencies.back()
+                      << ", \"occupancy\": " << (double)stats.used_area / ((double)dims * dims)
+                      << ", \"fragmentation\": " << stats.fragmentation
+                      << "}\n";
+            atlas_destroy(atlas);
+        }
+    }
+}
+
+/**
+ * Compares restoring a packed atlas by running the packing sequence again
+ * against serializing it once and deserializing the blob.
+ */
+static void bench_restore()
+{
+    const int dims = 4096;
+
+    for (auto &backend : backends)
+    {
+        AtlasOptions options = {};
+        options.dimensions = dims;
+        options.padding = 1;
+        options.backend = backend.second;
+        std::vector<std::pair<int, int>> sizes;
+        std::mt19937 rng(dims);
+
+        auto pack = [&](Atlas *atlas) {
+            for (auto size : sizes)
+            {
+                uint32_t id;
+                atlas_gen_texture(atlas, &id);
+                atlas_allocate_vtex_space(atlas, id, size.first, size.second);
+            }
+        };
+
+        Atlas *atlas = NULL;
+        if (!atlas_create_ex(&atlas, &options))
+        {
+            std::cerr << "Atlas creation failed.\n";
+            return;
+        }
+        for (int failed = 0; failed < 64;)
+        {
+            uint32_t id;
+            auto size = glyph_size(rng);
+            atlas_gen_texture(atlas, &id);
+            if (atlas_allocate_vtex_space(atlas, id, size.first, size.second))
+                sizes.push_back(size);
+            else
+                failed++, atlas_destroy_vtex(atlas, id);
+        }
+
+        size_t size = 0;
+        atlas_serialize(atlas, NULL, &size);
+        std::vector<uint8_t> blob(size);
+        auto start = Clock::now();
+        atlas_serialize(atlas, blob.data(), &size);
+        auto serialized = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        atlas_destroy(atlas);
+
+        start = Clock::now();
+        atlas_create_ex(&atlas, &options);
+        pack(atlas);
+        auto packed = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        atlas_destroy(atlas);
+
+        start = Clock::now();
+        int restored = atlas_deserialize(&atlas, blob.data(), blob.size());
+        auto deserialized = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        if (restored)
+            atlas_destroy(atlas);
+
+        std::cout << "restore backend=" << backend.first
+                  << " textures=" << sizes.size()
+                  << " blob_kb=" << blob.size() / 1024
+                  << " serialize_ms=" << serialized
+                  << " repack_ms=" << packed
+                  << " deserialize_ms=" << (restored ? deserialized : -1) << "\n";
+    }
+}
+
+/**
+ * Counts metadata allocations and the bytes they hold, through the atlas
+ * allocator callbacks.
+ */
+struct MemoryCounter
+{
+    size_t calls = 0;
+    size_t bytes = 0;
+    size_t peak = 0;
+
+    void add(size_t size)
+    {
+        calls++;
+        bytes += size;
+        peak = std::max(peak, bytes);
+    }
+
+    static void *alloc(size_t size, void *user)
+    {
+        ((MemoryCounter *)user)->add(size);
+        return malloc(size);
+    }
+
+    static void *realloc(void *ptr, size_t old_size, size_t size, void *user)
+    {
+        ((MemoryCounter *)user)->bytes -= old_size;
+        ((MemoryCounter *)user)->add(size);
+        return ::realloc(ptr, size);
+    }
+
+    static void free(void *ptr, size_t size, void *user)
+    {
+        ((MemoryCounter *)user)->bytes -= size;
+        ::free(ptr);
+    }
+};
+
+/**
+ * Reports the metadata footprint of every backend while filling a page with
+ * glyphs and churning it, and how many allocator calls each phase makes.
+ * Churn is then run again within a caller buffer of twice the peak size.
+ */
+static void bench_memory()
+{
+    const int dims = 2048, cycles = 2000;
+
+    for (auto &backend : backends)
+    {
+        MemoryCounter counter;
+        AtlasAllocator allocator = {MemoryCounter::alloc, MemoryCounter::realloc, MemoryCounter::free, &counter};
+        std::vector<uint8_t> buffer;
+        size_t fill_calls = 0, churn_calls = 0;
+        double counted_ns = 0;
+
+        for (int buffered = 0; buffered < 2; buffered++)
+        {
+            AtlasOptions options = {};
+            options.dimensions = dims;
+            options.padding = 1;
+            options.backend = backend.second;
+            if (buffered)
+            {
+                buffer.resize(counter.peak * 2);
+                options.buffer = buffer.data();
+                options.buffer_size = buffer.size();
+            }
+            else
+            {
+                options.allocator = &allocator;
+            }
+
+            Atlas *atlas = NULL;
+            if (!atlas_create_ex(&atlas, &options))
+            {
+                std::cerr << "Atlas creation failed.\n";
+                return;
+            }
+
+            std::mt19937 rng(dims);
+            std::vector<uint32_t> live;
+            for (int failed = 0; failed < 64;)
+            {
+                uint32_t id;
+                auto size = glyph_size(rng);
+                atlas_gen_texture(atlas, &id);
+                if (atlas_allocate_vtex_space(atlas, id, size.first, size.second))
+                    live.push_back(id);
+                else
+                    failed++, atlas_destroy_vtex(atlas, id);
+            }
+            fill_calls = counter.calls;
+
+            auto start = Clock::now();
+            for (int i = 0; i < cycles; i++)
+            {
+                auto victim = live.begin() + rng() % live.size();
+                atlas_destroy_vtex(atlas, *victim);
+
+                uint32_t id;
+                auto size = glyph_size(rng);
+                atlas_gen_texture(atlas, &id);
+                if (atlas_allocate_vtex_space(atlas, id, size.first, size.second))
+                {
+                    *victim = id;
+                }
+                else
+                {
+                    atlas_destroy_vtex(atlas, id);
+                    *victim = live.back();
+                    live.pop_back();
+                }
+            }
+            auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+            atlas_destroy(atlas);
+
+            if (!buffered)
+            {
+                churn_calls = counter.calls - fill_calls;
+                counted_ns = elapsed / cycles;
+                continue;
+            }
+
+            std::cout << "memory backend=" << backend.first
+                      << " textures=" << live.size()
+                      << " peak_kb=" << counter.peak / 1024
+                      << " fill_calls=" << fill_calls
+                      << " churn_calls=" << churn_calls
+                      << " ns/cycle=" << counted_ns
+                      << " buffer_ns/cycle=" << elapsed / cycles << "\n";
+        }
+    }
+}
+
+/**
+ * Measures allocation and release cost as free rects pile up: fills a large
+ * page with small textures, and each time the page tracks 1k, 10k and 100k
+ * holes, times a run of allocations and then of random destructions. Pages
+ * can only track 100k holes when built with ATLAS_LARGE_CAPACITY, the
+ * largest count is skipped otherwise.
+ */
+static void bench_holes()
+{
+    const int dims = 8192, allocs = 2048, releases = 512;
+    const uint32_t targets[] = {1000, 10000, 100000};
+    const struct
+    {
+        const char *name;
+        AtlasBackend backend;
+        AtlasHeuristic heuristic;
+    } configs[] = {
+        {"maxrects", ATLAS_BACKEND_MAXRECTS, ATLAS_HEURISTIC_BEST_AREA},
+        {"maxrects_bottom_left", ATLAS_BACKEND_MAXRECTS, ATLAS_HEURISTIC_BOTTOM_LEFT},
+        {"guillotine", ATLAS_BACKEND_GUILLOTINE, ATLAS_HEURISTIC_BEST_AREA},
+    };
+
+    for (auto &config : configs)
+    {
+        AtlasOptions options = {};
+        options.dimensions = dims;
+        options.padding = 1;
+        options.backend = config.backend;
+        options.heuristic = config.heuristic;
+        Atlas *atlas = NULL;
+        if (!atlas_create_ex(&atlas, &options))
+        {
+            std::cerr << "Atlas creation failed.\n";
+            return;
+        }
+
+        std::mt19937 rng(1);
+        std::uniform_int_distribution<int> size(4, 24);
+        std::vector<uint32_t> live;
+        auto allocate = [&]
+        {
+            uint32_t id;
+            atlas_gen_texture(atlas, &id);
+            if (atlas_allocate_vtex_space(atlas, id, size(rng), size(rng)))
+            {
+                live.push_back(id);
+                return true;
+            }
+            atlas_destroy_vtex(atlas, id);
+            return false;
+        };
+
+        AtlasStats stats = {};
+        bool full = false;
+        for (uint32_t target : targets)
+        {
+            while (!full && stats.hole_count < target)
+            {
+                for (int i = 0; i < 64 && !full; i++)
+                    full = !allocate();
+                atlas_get_stats(atlas, &stats);
+            }
+            if (full)
+                break;
+
+            int failed = 0;
+            auto start = Clock::now();
+            for (int i = 0; i < allocs; i++)
+                failed += !allocate();
+            auto alloc_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+            start = Clock::now();
+            for (int i = 0; i < releases; i++)
+            {
+                auto victim = live.begin() + rng() % live.size();
+                atlas_destroy_vtex(atlas, *victim);
+                *victim = live.back();
+                live.pop_back();
+            }
+            auto release_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+            std::cout << "holes backend=" << config.name
+                      << " holes=" << stats.hole_count
+                      << " failed=" << failed
+                      << " alloc_ns=" << alloc_ns / allocs
+                      << " release_ns=" << release_ns / releases << "\n";
+        }
+        atlas_destroy(atlas);
+    }
+}
+
+/**
+ * Places the same textures on a fixed 8192 page, and on a 512 page that grows
+ * one side at a time whenever an allocation fails, and compares the time
+ * taken, the time per atlas_grow call, and the final page size.
+ */
+static void bench_grow()
+{
+    const int count = 40000, max_dims = 8192;
+
+    for (auto &backend : backends)
+    {
+        std::vector<std::pair<int, int>> sizes;
+        std::mt19937 rng(count);
+        for (int i = 0; i < count; i++)
+            sizes.push_back(mixed_size(rng));
+
+        for (int start_dims : {max_dims, 512})
+        {
+            AtlasOptions options = {};
+            options.dimensions = (uint16_t)start_dims;
+            options.padding = 1;
+            options.backend = backend.second;
+            Atlas *atlas = NULL;
+            if (!atlas_create_ex(&atlas, &options))
+            {
+                std::cerr << "Atlas creation failed.\n";
+                return;
+            }
+
+            int grows = 0, failed = 0;
+            double grow_ns = 0;
+            auto start = Clock::now();
+            for (auto &size : sizes)
+            {
+                uint32_t id;
+                atlas_gen_texture(atlas, &id);
+                while (!atlas_allocate_vtex_space(atlas, id, size.first, size.second))
+                {
+                    int width = atlas_get_width(atlas), height = atlas_get_height(atlas);
+                    if (width >= max_dims && height >= max_dims)
+                    {
+                        failed++;
+                        break;
+                    }
+
+                    auto grow_start = Clock::now();
+                    atlas_grow(atlas, width <= height ? width * 2 : width, width <= height ? height : height * 2);
+                    grow_ns += std::chrono::duration<double, std::nano>(Clock::now() - grow_start).count();
+                    grows++;
+                }
+            }
+            auto elapsed = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+            AtlasStats stats;
+            atlas_get_stats(atlas, &stats);
+            uint64_t page_area = (uint64_t)atlas_get_width(atlas) * atlas_get_height(atlas);
+            std::cout << "grow backend=" << backend.first
+                      << " start=" << start_dims
+                      << " size=" << atlas_get_width(atlas) << "x" << atlas_get_height(atlas)
+                      << " rgba_mb=" << page_area * 4 / (1024 * 1024)
+                      << " grows=" << grows
+                      << " grow_us=" << (grows ? grow_ns / grows / 1000 : 0)
+                      << " failed=" << failed
+                      << " fill_ms=" << elapsed
+                      << " occupancy=" << (int)(100 * (double)stats.used_area / page_area) << "%\n";
+            atlas_destroy(atlas);
+        }
+    }
+}
+
+struct Benchmark
+{
+    const char *name;
+    void (*run)();
+};
+
+static const Benchmark benchmarks[] = {
+    {"lookup", bench_lookup},
+    {"allocate", bench_allocate},
+    {"churn", bench_churn},
+    {"backends", bench_backends},
+    {"pot", bench_pot},
+    {"density", bench_density},
+    {"batch", bench_batch},
+    {"soak", bench_soak},
+    {"threads", bench_threads},
+    {"defrag", bench_defrag},
+    {"compact", bench_compact},
+    {"stats", bench_stats},
+    {"workloads", bench_workloads},
+    {"restore", bench_restore},
+    {"memory", bench_memory},
+    {"holes", bench_holes},
+    {"grow", bench_grow},
+};
+
+int main(int argc, char *argv[])
+{
+    // Run every benchmark, or only the ones named on the command line.
+    for (auto &bench : benchmarks)
+    {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; i++)
+            selected |= std::string(argv[i]) == bench.name;
+
+        if (selected)
+            bench.run();
+    }
+
+    return 0;
+}
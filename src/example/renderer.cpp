@@ -69,6 +69,9 @@ void Renderer::Render(int w, int h)
         glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, 4, GL_DEPTH24_STENCIL8, w, h, GL_TRUE);
     }
 
+    // Spread atlas compaction over frames, a quarter megatexel at a time
+    Textures::Compact(1 << 18);
+
     glBindFramebuffer(GL_FRAMEBUFFER, fbo);
     glEnable(GL_MULTISAMPLE);
 
@@ -173,6 +176,7 @@ int Renderer::LoadScene(const std::string &path, const std::string &file)
         LoadTextures(path, mat, aiTextureType_DIFFUSE);
         LoadTextures(path, mat, aiTextureType_NORMALS);
     }
+    Textures::Commit();
 
     for (unsigned int i = 0; i < scene->mNumMeshes; i++)
     {
@@ -2,6 +2,7 @@
 #include <map>
 #include <vector>
 #include <fstream>
+#include <algorithm>
 
 #include <SDL.h>
 #include <SDL_image.h>
@@ -16,17 +17,39 @@
 #include "textures.h"
 
 /**
- * Texture Atlas page and accompanying partitioning structure
+ * Texture Atlas pages and accompanying partitioning structure
  */
-GLuint tex_page;
+static std::vector<GLuint> tex_pages;
 static Atlas *atlas = NULL;
 static std::map<std::string, GLuint> textures;
 static std::map<std::string, GLuint> vtextures;
 
+/**
+ * Read and draw framebuffers used to copy moved textures, see Textures::Compact.
+ */
+static GLuint compact_fbos[2];
+
+/**
+ * Textures loaded but not yet placed in the atlas, see Textures::Commit.
+ */
+struct PendingTexture
+{
+    std::string file;
+    GLuint vtex_id;
+    SDL_Surface *surface;
+};
+static std::vector<PendingTexture> pending;
+
+/**
+ * Pages start small and grow, one side doubled at a time, up to this size.
+ */
+static const uint16_t initial_page_size = 2048;
+static const uint16_t max_page_size = 8192;
+
 /**
  * OpenGL texture setup routine.
  */
-static GLuint texture_init(GLenum filter, unsigned int size = 0)
+static GLuint texture_init(GLenum filter, unsigned int width = 0, unsigned int height = 0)
 {
     GLuint tex;
     glGenTextures(1, &tex);
@@ -42,8 +65,8 @@ static GLuint texture_init(GLenum filter, unsigned int size = 0)
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
     //Initialize empty texture page when we have a size argument
-    if (size)
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    if (width && height)
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 
     return tex;
 }
@@ -53,15 +76,24 @@ int Textures::Init()
     if (atlas)
         return 1;
 
-    // Create a texture atlas
-    if (!atlas_create(&atlas, 8096, 16))
+    // Create a small texture atlas, growing its pages as textures come in and
+    // spilling over to new pages once they can't grow any further
+    AtlasOptions options = {};
+    options.dimensions = initial_page_size;
+    options.padding = 16;
+    options.backend = ATLAS_BACKEND_MAXRECTS;
+    options.heuristic = ATLAS_HEURISTIC_BEST_AREA;
+    options.max_pages = 16;
+    options.page_order = ATLAS_PAGES_FIRST_FIT;
+    if (!atlas_create_ex(&atlas, &options))
     {
         std::cerr << "Atlas creation failed.\n";
         return 0;
     }
 
-    // Create the corresponding texture page
-    tex_page = texture_init(GL_NEAREST, atlas_get_dimensions(atlas));
+    // Create the corresponding first texture page
+    tex_pages.push_back(texture_init(GL_NEAREST, atlas_get_width(atlas), atlas_get_height(atlas)));
+    glGenFramebuffers(2, compact_fbos);
 
     return 1;
 }
@@ -73,8 +105,17 @@ void Textures::Destroy()
         glDeleteTextures(1, &texture.second);
     textures.clear();
 
+    //Drop textures never committed to the atlas
+    for (auto &tex : pending)
+        SDL_FreeSurface(tex.surface);
+    pending.clear();
+
     //Delete created OpenGL vtextures
-    glDeleteTextures(1, &tex_page);
+    for (auto page : tex_pages)
+        glDeleteTextures(1, &page);
+    tex_pages.clear();
+    glDeleteFramebuffers(2, compact_fbos);
+    compact_fbos[0] = compact_fbos[1] = 0;
     atlas_destroy(atlas);
     atlas = NULL;
     vtextures.clear();
@@ -117,7 +158,6 @@ int Textures::Load(const std::string &path, const std::string &file)
 
         //Load texture as RGBA32
         SDL_Surface *tex = loadAsRGBA32(path + file);
-        FREE_ON_EXIT(tex);
         if (!tex)
             return 0;
 
@@ -128,32 +168,145 @@ int Textures::Load(const std::string &path, const std::string &file)
         glGenerateMipmap(GL_TEXTURE_2D);
 
         //Create an atlased OpenGL texture
-        //Reserve a texture id for ourselves
+        //Reserve a texture id for ourselves, space is allocated on commit
         GLuint vtex_id;
         atlas_gen_texture(atlas, &vtex_id);
+        pending.push_back({file, vtex_id, tex});
 
-        //Allocate space for it somewhere in the atlas
-        if (atlas_allocate_vtex_space(atlas, vtex_id, tex->w, tex->h))
-        {
-            uint16_t xywh[4];
-            atlas_get_vtex_xywh_coords(atlas, vtex_id, 0, &xywh[0]);
+        textures[file] = tex_id;
+        vtextures[file] = vtex_id;
+    }
 
-            //Now upload the texture
-            glBindTexture(GL_TEXTURE_2D, tex_page);
-            glTexSubImage2D(GL_TEXTURE_2D, 0, xywh[0], xywh[1], xywh[2], xywh[3],
-                            GL_RGBA, GL_UNSIGNED_BYTE, tex->pixels);
-        }
+    return 1;
+}
+
+/**
+ * Grows the atlas pages until the pending textures would roughly fit in the
+ * pages already open, and copies every texture page over to the top-left of
+ * a larger one.
+ */
+static void grow_pages()
+{
+    GLint max_size;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+    uint16_t limit = (uint16_t)std::min<GLint>(max_page_size, max_size);
+
+    AtlasStats stats;
+    atlas_get_stats(atlas, &stats);
+    uint64_t needed = stats.used_area;
+    uint16_t padding = atlas_get_padding(atlas), widest = 0, tallest = 0;
+    for (auto &tex : pending)
+    {
+        uint16_t w = tex.surface->w + padding * 2, h = tex.surface->h + padding * 2;
+        needed += (uint64_t)w * h;
+        widest = std::max(widest, w);
+        tallest = std::max(tallest, h);
+    }
+
+    //Double the shorter side first, keeping pages close to square
+    uint16_t old_width = atlas_get_width(atlas), old_height = atlas_get_height(atlas);
+    uint16_t width = old_width, height = old_height;
+    while ((uint64_t)width * height * stats.page_count < needed || widest > width || tallest > height)
+    {
+        if (width <= height && width * 2 <= limit)
+            width *= 2;
+        else if (height * 2 <= limit)
+            height *= 2;
         else
+            break;
+    }
+
+    if ((width == old_width && height == old_height) || !atlas_grow(atlas, width, height))
+        return;
+
+    GLuint fbo;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    for (auto &page : tex_pages)
+    {
+        GLuint grown = texture_init(GL_NEAREST, width, height);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, page, 0);
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, old_width, old_height);
+        glDeleteTextures(1, &page);
+        page = grown;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+}
+
+int Textures::Commit()
+{
+    std::vector<uint32_t> ids;
+    std::vector<uint16_t> wh;
+    for (auto &tex : pending)
+    {
+        ids.push_back(tex.vtex_id);
+        wh.push_back(tex.surface->w);
+        wh.push_back(tex.surface->h);
+    }
+
+    //Make room before spilling over to new pages
+    grow_pages();
+
+    //Allocate space for all of them at once, largest first
+    std::vector<uint8_t> results(pending.size());
+    int placed = atlas_allocate_batch(atlas, ids.data(), wh.data(), pending.size(),
+                                      ATLAS_SORT_MAX_SIDE, results.data());
+
+    for (size_t i = 0; i < pending.size(); i++)
+    {
+        SDL_Surface *tex = pending[i].surface;
+        FREE_ON_EXIT(tex);
+
+        if (!results[i])
         {
-            std::cerr << "Failed to allocate atlas space for '" << file.c_str() << "'.\n";
-            return 0;
+            std::cerr << "Failed to allocate atlas space for '" << pending[i].file.c_str() << "'.\n";
+            continue;
         }
 
-        textures[file] = tex_id;
-        vtextures[file] = vtex_id;
+        uint16_t xywh[4], page;
+        atlas_get_vtex_xywh_coords(atlas, pending[i].vtex_id, 0, &xywh[0]);
+        atlas_get_vtex_page(atlas, pending[i].vtex_id, &page);
+
+        //Create texture pages the atlas spilled over to
+        while (tex_pages.size() <= page)
+            tex_pages.push_back(texture_init(GL_NEAREST, atlas_get_width(atlas), atlas_get_height(atlas)));
+
+        //Now upload the texture
+        glBindTexture(GL_TEXTURE_2D, tex_pages[page]);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, xywh[0], xywh[1], xywh[2], xywh[3],
+                        GL_RGBA, GL_UNSIGNED_BYTE, tex->pixels);
     }
+    pending.clear();
 
-    return 1;
+    return placed;
+}
+
+/**
+ * Compacts the atlas a little, copying the moved textures to their new spot.
+ */
+void Textures::Compact(uint64_t max_texels)
+{
+    AtlasMove moves[64];
+    size_t move_count;
+
+    if (!atlas_compact_step(atlas, max_texels, moves, 64, &move_count) || !move_count)
+        return;
+
+    //Blit each texture, padding included, from its old page to its new one
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, compact_fbos[0]);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, compact_fbos[1]);
+    for (size_t i = 0; i < move_count; i++)
+    {
+        const uint16_t *src = moves[i].old_xywh, *dst = moves[i].new_xywh;
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                               tex_pages[moves[i].old_page], 0);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                               tex_pages[moves[i].new_page], 0);
+        glBlitFramebuffer(src[0], src[1], src[0] + src[2], src[1] + src[3],
+                          dst[0], dst[1], dst[0] + dst[2], dst[1] + dst[3], GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 /**
@@ -197,13 +350,18 @@ void ScrollWhenDraggingOnVoid(const ImVec2& delta)
 
 void Textures::RenderImGUI()
 {
-    float tex_size = (float)atlas_get_dimensions(atlas);
+    float tex_width = (float)atlas_get_width(atlas), tex_height = (float)atlas_get_height(atlas);
 
     ImGui::Begin("Atlas", 0, ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoScrollWithMouse);
+    static int page = 0;
+    if (tex_pages.size() > 1)
+        ImGui::SliderInt("Page", &page, 0, (int)tex_pages.size() - 1);
+    page = std::min(page, (int)tex_pages.size() - 1);
+
     float wheel_delta = ImGui::GetIO().MouseWheel;
     static float scale = 1.f;
     scale += 0.05f * wheel_delta;
-    ImGui::Image((void*)(intptr_t)tex_page, ImVec2(tex_size * powf(scale, 3), tex_size * powf(scale, 3)));
+    ImGui::Image((void*)(intptr_t)tex_pages[page], ImVec2(tex_width * powf(scale, 3), tex_height * powf(scale, 3)));
     
     ImVec2 mouse_delta = ImGui::GetIO().MouseDelta;
     ScrollWhenDraggingOnVoid(ImVec2(-mouse_delta.x, -mouse_delta.y));
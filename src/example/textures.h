@@ -6,6 +6,8 @@ namespace Textures
     int Init();
     void Destroy();
     int Load(const std::string &path, const std::string &name);
+    int Commit();
+    void Compact(uint64_t max_texels);
     GLuint Lookup(const std::string &name);
     GLuint LookupVirtual(const std::string &name);
     void RenderImGUI();
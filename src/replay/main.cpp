@@ -0,0 +1,263 @@
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+#include "texture_atlas.h"
+
+using Clock = std::chrono::steady_clock;
+
+static const std::pair<const char *, AtlasBackend> backends[] = {
+    {"maxrects", ATLAS_BACKEND_MAXRECTS},
+    {"skyline", ATLAS_BACKEND_SKYLINE},
+    {"guillotine", ATLAS_BACKEND_GUILLOTINE},
+    {"shelf", ATLAS_BACKEND_SHELF},
+    {"buddy", ATLAS_BACKEND_BUDDY},
+};
+
+static const char *op_names[] = {"create", "gen", "allocate", "destroy", "allocate_ex", "grow"};
+
+/**
+ * Trace record, see AtlasTraceOp for the fields each call records. Page
+ * growth keeps the new page size in w and h.
+ */
+struct Record
+{
+    AtlasTraceOp op;
+    uint32_t id;
+    uint16_t w, h;
+    uint8_t flags; // Allocation flags, ALLOCATE_EX records are folded into ALLOCATE.
+    uint8_t result;
+};
+
+/**
+ * Outcome of a replay run.
+ */
+struct Replay
+{
+    double ns[ATLAS_TRACE_GROW + 1] = {};
+    size_t count[ATLAS_TRACE_GROW + 1] = {};
+    size_t failed = 0;   // Allocations that found no room.
+    size_t diverged = 0; // Allocations whose result differs from the trace.
+    uint32_t peak_holes = 0;
+    uint16_t width = 0, height = 0; // Final page size.
+    AtlasStats stats = {};
+};
+
+/**
+ * Reads a little-endian value out of a trace, advancing the read position.
+ */
+static bool read_value(const std::vector<uint8_t> &data, size_t &at, int size, uint32_t &value)
+{
+    if (at + size > data.size())
+        return false;
+
+    value = 0;
+    for (int i = 0; i < size; i++)
+        value |= (uint32_t)data[at++] << (i * 8);
+    return true;
+}
+
+/**
+ * Loads a trace file, decoding the atlas options it was recorded with and
+ * every call recorded after them.
+ */
+static bool load_trace(const std::string &path, AtlasOptions &options, std::vector<Record> &records)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    size_t at = 5;
+    uint32_t op, values[8] = {};
+    if (data.size() < at || memcmp(data.data(), ATLAS_TRACE_MAGIC, 4) != 0 || !data[4] ||
+        data[4] > ATLAS_TRACE_VERSION)
+        return false;
+
+    // Creation options come first, the page height since version 3.
+    const int option_sizes[8] = {2, 2, 1, 1, 2, 1, 1, 2};
+    int option_count = data[4] >= 3 ? 8 : 7;
+    if (!read_value(data, at, 1, op) || op != ATLAS_TRACE_CREATE)
+        return false;
+    for (int i = 0; i < option_count; i++)
+    {
+        if (!read_value(data, at, option_sizes[i], values[i]))
+            return false;
+    }
+
+    options = {};
+    options.dimensions = (uint16_t)values[0];
+    options.padding = (uint16_t)values[1];
+    options.backend = (AtlasBackend)values[2];
+    options.heuristic = (AtlasHeuristic)values[3];
+    options.max_pages = (uint16_t)values[4];
+    options.page_order = (AtlasPageOrder)values[5];
+    options.concurrent = (int)values[6];
+    options.height = (uint16_t)values[7];
+
+    while (at < data.size())
+    {
+        Record record = {};
+        uint32_t id = 0, w = 0, h = 0, flags = 0, result = 1;
+        if (!read_value(data, at, 1, op))
+            return false;
+
+        if (op == ATLAS_TRACE_GROW)
+        {
+            if (!read_value(data, at, 2, w) || !read_value(data, at, 2, h) || !read_value(data, at, 1, result))
+                return false;
+        }
+        else if (!read_value(data, at, 4, id))
+            return false;
+
+        bool allocate = op == ATLAS_TRACE_ALLOCATE || op == ATLAS_TRACE_ALLOCATE_EX;
+        if (allocate && (!read_value(data, at, 2, w) || !read_value(data, at, 2, h)))
+            return false;
+        if (op == ATLAS_TRACE_ALLOCATE_EX && !read_value(data, at, 1, flags))
+            return false;
+        if (allocate && !read_value(data, at, 1, result))
+            return false;
+        if (!allocate && op != ATLAS_TRACE_GEN && op != ATLAS_TRACE_DESTROY && op != ATLAS_TRACE_GROW)
+            return false;
+
+        record.op = allocate ? ATLAS_TRACE_ALLOCATE : (AtlasTraceOp)op;
+        record.id = id;
+        record.w = (uint16_t)w;
+        record.h = (uint16_t)h;
+        record.flags = (uint8_t)flags;
+        record.result = (uint8_t)result;
+        records.push_back(record);
+    }
+
+    return true;
+}
+
+/**
+ * Replays every recorded call against a new atlas, mapping recorded ids to
+ * the ones generated now. Tracking the peak hole count takes a stats query
+ * after every allocation and destruction, so it's done on a separate run
+ * from the timed one.
+ */
+static bool replay(const AtlasOptions &options, const std::vector<Record> &records, bool track_holes,
+                   Replay &result)
+{
+    Atlas *atlas = NULL;
+    if (!atlas_create_ex(&atlas, &options))
+        return false;
+
+    std::unordered_map<uint32_t, uint32_t> ids;
+    for (auto &record : records)
+    {
+        uint32_t id = 0;
+        auto found = ids.find(record.id);
+        if (record.op != ATLAS_TRACE_GEN && found != ids.end())
+            id = found->second;
+
+        int success = 0;
+        auto start = Clock::now();
+        switch (record.op)
+        {
+        case ATLAS_TRACE_GEN:
+            success = atlas_gen_texture(atlas, &id);
+            break;
+        case ATLAS_TRACE_ALLOCATE:
+            success = atlas_allocate_vtex_space_ex(atlas, id, record.w, record.h, record.flags);
+            break;
+        case ATLAS_TRACE_DESTROY:
+            success = atlas_destroy_vtex(atlas, id);
+            break;
+        case ATLAS_TRACE_GROW:
+            success = atlas_grow(atlas, record.w, record.h);
+            break;
+        default:
+            break;
+        }
+        result.ns[record.op] += std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        result.count[record.op]++;
+
+        if (record.op == ATLAS_TRACE_GEN)
+            ids[record.id] = id;
+        else if (record.op == ATLAS_TRACE_DESTROY)
+            ids.erase(record.id);
+
+        if (record.op == ATLAS_TRACE_ALLOCATE)
+        {
+            result.failed += !success;
+            result.diverged += success != record.result;
+        }
+
+        if (track_holes && record.op != ATLAS_TRACE_GEN && record.op != ATLAS_TRACE_GROW)
+        {
+            AtlasStats stats;
+            atlas_get_stats(atlas, &stats);
+            if (stats.hole_count > result.peak_holes)
+                result.peak_holes = stats.hole_count;
+        }
+    }
+
+    atlas_get_stats(atlas, &result.stats);
+    result.width = atlas_get_width(atlas);
+    result.height = atlas_get_height(atlas);
+    atlas_destroy(atlas);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <trace> [all | backend...]\n";
+        return 1;
+    }
+
+    AtlasOptions recorded;
+    std::vector<Record> records;
+    if (!load_trace(argv[1], recorded, records))
+    {
+        std::cerr << "Failed to load trace '" << argv[1] << "'.\n";
+        return 1;
+    }
+
+    // Replay on the recorded backend, or on the ones named on the command line.
+    for (auto &backend : backends)
+    {
+        bool selected = argc < 3 && backend.second == recorded.backend;
+        for (int i = 2; i < argc; i++)
+            selected |= std::string(argv[i]) == backend.first || std::string(argv[i]) == "all";
+        if (!selected)
+            continue;
+
+        AtlasOptions options = recorded;
+        options.backend = backend.second;
+
+        Replay timed, tracked;
+        if (!replay(options, records, false, timed) || !replay(options, records, true, tracked))
+        {
+            std::cerr << "Atlas creation failed.\n";
+            return 1;
+        }
+
+        uint64_t page_area = (uint64_t)timed.width * timed.height;
+        std::cout << "replay backend=" << backend.first << " ops=" << records.size();
+        for (int op = ATLAS_TRACE_GEN; op <= ATLAS_TRACE_DESTROY; op++)
+            std::cout << " " << op_names[op] << "_ns=" << (timed.count[op] ? timed.ns[op] / timed.count[op] : 0);
+        if (timed.count[ATLAS_TRACE_GROW])
+            std::cout << " grow_ns=" << timed.ns[ATLAS_TRACE_GROW] / timed.count[ATLAS_TRACE_GROW]
+                      << " size=" << timed.width << "x" << timed.height;
+        std::cout << " failed=" << timed.failed
+                  << " diverged=" << timed.diverged
+                  << " peak_holes=" << tracked.peak_holes
+                  << " pages=" << timed.stats.page_count
+                  << " occupancy=" << (int)(100 * (double)timed.stats.used_area / (page_area * timed.stats.page_count)) << "%"
+                  << "\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,428 @@
+/**
+ * Allocator consistency checks. The atlas sources are built into this file,
+ * so the checks can look at the page backends directly instead of only going
+ * through the public calls. Every test runs on each backend, and the run
+ * stops at the first broken invariant.
+ */
+#include "texture_atlas.c"
+
+#if defined(_WIN32)
+typedef HANDLE TestThread;
+#else
+typedef pthread_t TestThread;
+#endif
+
+#define CHECK(condition)                                                               \
+    do {                                                                               \
+        if (!(condition)) {                                                            \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            exit(1);                                                                   \
+        }                                                                              \
+    } while (0)
+
+#define TEST_BACKENDS 5
+#define TEST_HEURISTICS 5
+#define TEST_THREADS 4
+
+static const char *backend_names[TEST_BACKENDS] = {"maxrects", "skyline", "guillotine", "shelf", "buddy"};
+
+/**
+ * Small xorshift generator, so runs are the same on every platform.
+ * @arg state: Pointer to the generator state, never 0.
+ * @return: Random value in [min, max].
+ **/
+static int test_random(uint32_t *state, int min, int max)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return min + (int)(x % (uint32_t)(max - min + 1));
+}
+
+/**
+ * Creates an atlas, failing the run if that isn't possible.
+ * @arg backend: Packing backend.
+ * @arg heuristic: Hole choice.
+ * @arg dimensions: Page width and height.
+ * @arg max_pages: Pages to spill over to.
+ * @arg concurrent: Whether the atlas is shared between threads.
+ * @return: Pointer to the new atlas.
+ **/
+static Atlas *test_create(int backend, int heuristic, uint16_t dimensions, uint16_t max_pages, int concurrent)
+{
+    AtlasOptions options;
+    memset(&options, 0, sizeof(options));
+    options.dimensions = dimensions;
+    options.padding = 1;
+    options.backend = (AtlasBackend)backend;
+    options.heuristic = (AtlasHeuristic)heuristic;
+    options.max_pages = max_pages;
+    options.concurrent = concurrent;
+
+    Atlas *atlas = NULL;
+    CHECK(atlas_create_ex(&atlas, &options));
+    return atlas;
+}
+
+/**
+ * Checks a page against the textures of its owner. Textures must lie within
+ * the page without overlapping each other or live arenas, and the used area
+ * must add up to them and the arenas. Holes of MaxRects and Guillotine pages
+ * must cover exactly the space left, which is what a full rebuild would
+ * produce, and Guillotine holes must not overlap. Pages waiting for a rebuild
+ * are rebuilt first.
+ * @arg atlas: Pointer to the owning atlas.
+ * @arg page: Pointer to the page.
+ * @arg backend: Backend the atlas was created with.
+ **/
+static void check_page(Atlas *atlas, Atlas *page, int backend)
+{
+    if (page->invalidated)
+        CHECK(atlas_rebuild(page));
+
+    int width = page->width, height = page->height;
+    uint8_t *used = (uint8_t*)calloc((size_t)width * height, 1);
+    uint8_t *holes = (uint8_t*)calloc((size_t)width * height, 1);
+    CHECK(used && holes);
+
+    uint64_t used_area = 0;
+    for (int i = 0; i < page->arena_count; i++) {
+        Rect *arena = &page->arenas[i];
+        CHECK(arena->right <= width && arena->down <= height);
+        for (int y = arena->up; y < arena->down; y++) {
+            for (int x = arena->left; x < arena->right; x++)
+                CHECK(used[y * width + x]++ == 0);
+        }
+        used_area += rect_area(arena);
+    }
+
+    // Textures inside a live arena are covered by the arena as a whole.
+    for (int i = 0; i < atlas->vtex_slot_count; i++) {
+        Rect *rect = &atlas->vtexes[i].rect;
+        if (rect_area(rect) == 0 || atlas->vtexes[i].page != page->page || atlas_lookup_arena(page, rect) != -1)
+            continue;
+
+        CHECK(rect->right <= width && rect->down <= height);
+        for (int y = rect->up; y < rect->down; y++) {
+            for (int x = rect->left; x < rect->right; x++)
+                CHECK(used[y * width + x]++ == 0);
+        }
+        used_area += rect_area(rect);
+    }
+    CHECK(used_area == page->used_area);
+
+    if (backend == ATLAS_BACKEND_MAXRECTS || backend == ATLAS_BACKEND_GUILLOTINE) {
+        for (int i = 0; i < page->hole_count; i++) {
+            Rect hole;
+            atlas_load_hole(page, i, &hole);
+            CHECK(rect_area(&hole) != 0 && hole.right <= width && hole.down <= height);
+            for (int y = hole.up; y < hole.down; y++) {
+                for (int x = hole.left; x < hole.right; x++) {
+                    CHECK(backend == ATLAS_BACKEND_MAXRECTS || holes[y * width + x] == 0);
+                    holes[y * width + x] = 1;
+                }
+            }
+        }
+        for (int i = 0; i < width * height; i++)
+            CHECK(holes[i] != used[i]);
+    }
+
+    free(used);
+    free(holes);
+}
+
+/**
+ * Checks every page of an atlas, see check_page.
+ * @arg atlas: Pointer to the atlas.
+ * @arg backend: Backend the atlas was created with.
+ **/
+static void check_atlas(Atlas *atlas, int backend)
+{
+    uint64_t padding_area = 0;
+    for (int i = 0; i < atlas->vtex_slot_count; i++)
+        padding_area += rect_padding_area(&atlas->vtexes[i].rect, atlas->padding);
+    CHECK(padding_area == atlas->padding_area);
+
+    for (int i = 0; i < atlas->page_count; i++)
+        check_page(atlas, atlas->pages[i], backend);
+}
+
+/**
+ * Churns textures in and out of a single page. Space is given back one
+ * texture at a time, and the pages must stay as consistent as after a full
+ * rebuild, which then runs from the same state and is checked again.
+ * Emptying the page must give all of it back.
+ **/
+static void test_release(void)
+{
+    for (int backend = 0; backend < TEST_BACKENDS; backend++) {
+        Atlas *atlas = test_create(backend, ATLAS_HEURISTIC_BEST_AREA, 512, 1, 0);
+        uint32_t state = 1, ids[1024];
+        int count = 0;
+
+        for (int step = 0; step < 4000; step++) {
+            if (count < 1024 && test_random(&state, 0, 2) != 0) {
+                CHECK(atlas_gen_texture(atlas, &ids[count]));
+                if (atlas_allocate_vtex_space(atlas, ids[count], test_random(&state, 1, 48),
+                                              test_random(&state, 1, 48)))
+                    count++;
+                else
+                    CHECK(atlas_destroy_vtex(atlas, ids[count]));
+            } else if (count) {
+                int i = test_random(&state, 0, count - 1);
+                CHECK(atlas_destroy_vtex(atlas, ids[i]));
+                ids[i] = ids[--count];
+            }
+
+            if (step % 500 == 499) {
+                check_atlas(atlas, backend);
+                CHECK(atlas_rebuild(atlas));
+                check_atlas(atlas, backend);
+            }
+        }
+
+        while (count)
+            CHECK(atlas_destroy_vtex(atlas, ids[--count]));
+        check_atlas(atlas, backend);
+        CHECK(atlas->used_area == 0 && atlas->padding_area == 0);
+
+        uint32_t id;
+        CHECK(atlas_gen_texture(atlas, &id));
+        CHECK(atlas_allocate_vtex_space(atlas, id, 510, 510));
+        atlas_destroy(atlas);
+        printf("release backend=%s ok\n", backend_names[backend]);
+    }
+}
+
+/**
+ * Grows partly filled pages, first to a non-square size, and fills them
+ * afterwards. Grown pages must be as consistent as a rebuild at the new size,
+ * and normalized coordinates must follow the new size.
+ **/
+static void test_grow(void)
+{
+    for (int backend = 0; backend < TEST_BACKENDS; backend++) {
+        Atlas *atlas = test_create(backend, ATLAS_HEURISTIC_BEST_AREA, 256, 2, 0);
+        uint32_t state = 2, ids[2048];
+        int count = 0;
+
+        for (int i = 0; i < 200; i++) {
+            CHECK(atlas_gen_texture(atlas, &ids[count]));
+            if (atlas_allocate_vtex_space(atlas, ids[count], test_random(&state, 4, 40), test_random(&state, 4, 40)))
+                count++;
+            else
+                CHECK(atlas_destroy_vtex(atlas, ids[count]));
+            if (count && test_random(&state, 0, 3) == 0) {
+                int j = test_random(&state, 0, count - 1);
+                CHECK(atlas_destroy_vtex(atlas, ids[j]));
+                ids[j] = ids[--count];
+            }
+        }
+
+        CHECK(!atlas_grow(atlas, 128, 256));
+        CHECK(atlas_grow(atlas, 512, 256));
+        check_atlas(atlas, backend);
+        CHECK(atlas_grow(atlas, 512, 512));
+        check_atlas(atlas, backend);
+        CHECK(atlas_get_width(atlas) == 512 && atlas_get_height(atlas) == 512);
+
+        for (int misses = 0; misses < 64 && count < 2048;) {
+            CHECK(atlas_gen_texture(atlas, &ids[count]));
+            if (atlas_allocate_vtex_space(atlas, ids[count], test_random(&state, 4, 40), test_random(&state, 4, 40))) {
+                count++;
+            } else {
+                CHECK(atlas_destroy_vtex(atlas, ids[count]));
+                misses++;
+            }
+        }
+        check_atlas(atlas, backend);
+
+        for (int i = 0; i < count; i++) {
+            uint16_t xywh[4];
+            float uvst[4];
+            CHECK(atlas_get_vtex_xywh_coords(atlas, ids[i], 1, xywh));
+            CHECK(atlas_get_vtex_uvst_coords(atlas, ids[i], 1, uvst));
+            CHECK(uvst[0] == (float)xywh[0] / 512 && uvst[3] == (float)(xywh[1] + xywh[3]) / 512);
+        }
+
+        atlas_destroy(atlas);
+        printf("grow backend=%s ok\n", backend_names[backend]);
+    }
+}
+
+/**
+ * Packs textures into arenas under every heuristic, with some destroyed
+ * before and after their arena gets retired, while other textures go
+ * straight into the pages.
+ **/
+static void test_arenas(void)
+{
+    for (int backend = 0; backend < TEST_BACKENDS; backend++) {
+        for (int heuristic = 0; heuristic < TEST_HEURISTICS; heuristic++) {
+            Atlas *atlas = test_create(backend, heuristic, 512, 4, 0);
+            uint32_t state = 3, ids[1024];
+            int count = 0;
+
+            for (int round = 0; round < 8; round++) {
+                AtlasArena *arena;
+                CHECK(atlas_arena_create(atlas, 128, &arena));
+
+                int start = count;
+                for (int i = 0; i < 48 && count < 1024; i++) {
+                    int w = test_random(&state, 2, 24), h = test_random(&state, 2, 24);
+                    CHECK(atlas_gen_texture(atlas, &ids[count]));
+                    if (atlas_arena_allocate(arena, ids[count], w, h) ||
+                        atlas_allocate_vtex_space(atlas, ids[count], w, h))
+                        count++;
+                    else
+                        CHECK(atlas_destroy_vtex(atlas, ids[count]));
+                }
+
+                for (int i = start; i < count; i++) {
+                    if (test_random(&state, 0, 2) == 0) {
+                        CHECK(atlas_destroy_vtex(atlas, ids[i]));
+                        ids[i--] = ids[--count];
+                    }
+                }
+                check_atlas(atlas, backend);
+
+                atlas_arena_retire(arena);
+                check_atlas(atlas, backend);
+
+                for (int i = start; i < count; i++) {
+                    if (test_random(&state, 0, 3) == 0) {
+                        CHECK(atlas_destroy_vtex(atlas, ids[i]));
+                        ids[i--] = ids[--count];
+                    }
+                }
+                check_atlas(atlas, backend);
+            }
+
+            atlas_destroy(atlas);
+        }
+        printf("arenas backend=%s ok\n", backend_names[backend]);
+    }
+}
+
+typedef struct ThreadRun {
+    Atlas *atlas;
+    int thread;
+    uint32_t ids[256];
+    int count;
+} ThreadRun;
+
+/**
+ * Thread body of test_threads. Each round places a handful of textures one
+ * at a time, as a batch or in an arena, and destroys most of them again.
+ * The first thread grows the pages halfway through.
+ **/
+#if defined(_WIN32)
+static DWORD WINAPI thread_main(LPVOID data)
+#else
+static void *thread_main(void *data)
+#endif
+{
+    ThreadRun *run = (ThreadRun*)data;
+    uint32_t state = (uint32_t)run->thread + 10;
+
+    for (int round = 0; round < 300; round++) {
+        uint32_t ids[16];
+        uint16_t wh[32];
+        uint8_t results[16];
+        for (int i = 0; i < 16; i++) {
+            CHECK(atlas_gen_texture(run->atlas, &ids[i]));
+            wh[i * 2] = (uint16_t)test_random(&state, 2, 40);
+            wh[i * 2 + 1] = (uint16_t)test_random(&state, 2, 40);
+        }
+
+        AtlasArena *arena = NULL;
+        int mode = (round + run->thread) % 3;
+        if (mode == 0) {
+            for (int i = 0; i < 16; i++)
+                results[i] = (uint8_t)atlas_allocate_vtex_space(run->atlas, ids[i], wh[i * 2], wh[i * 2 + 1]);
+        } else if (mode == 1) {
+            atlas_allocate_batch(run->atlas, ids, wh, 16, ATLAS_SORT_AREA, results);
+        } else {
+            int created = atlas_arena_create(run->atlas, 96, &arena);
+            for (int i = 0; i < 16; i++)
+                results[i] = (uint8_t)((created && atlas_arena_allocate(arena, ids[i], wh[i * 2], wh[i * 2 + 1])) ||
+                                       atlas_allocate_vtex_space(run->atlas, ids[i], wh[i * 2], wh[i * 2 + 1]));
+            if (!created)
+                arena = NULL;
+        }
+
+        for (int i = 0; i < 16; i++) {
+            float uvst[4];
+            CHECK(!results[i] || atlas_get_vtex_uvst_coords(run->atlas, ids[i], 0, uvst));
+            if (results[i] && test_random(&state, 0, 7) == 0 && run->count < 256)
+                run->ids[run->count++] = ids[i];
+            else
+                CHECK(atlas_destroy_vtex(run->atlas, ids[i]));
+        }
+
+        if (arena)
+            atlas_arena_retire(arena);
+        if (run->thread == 0 && round == 150)
+            CHECK(atlas_grow(run->atlas, 1024, 512));
+    }
+
+#if defined(_WIN32)
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * Shares an atlas between threads allocating, destroying, batching, packing
+ * arenas and growing pages, then checks the textures left. Build with a
+ * thread sanitizer to check the locking as well.
+ **/
+static void test_threads(void)
+{
+    for (int backend = 0; backend < TEST_BACKENDS; backend++) {
+        Atlas *atlas = test_create(backend, ATLAS_HEURISTIC_BEST_AREA, 512, 32, 1);
+        ThreadRun runs[TEST_THREADS];
+        TestThread threads[TEST_THREADS];
+
+        for (int i = 0; i < TEST_THREADS; i++) {
+            runs[i].atlas = atlas;
+            runs[i].thread = i;
+            runs[i].count = 0;
+#if defined(_WIN32)
+            CHECK((threads[i] = CreateThread(NULL, 0, thread_main, &runs[i], 0, NULL)) != NULL);
+#else
+            CHECK(pthread_create(&threads[i], NULL, thread_main, &runs[i]) == 0);
+#endif
+        }
+        for (int i = 0; i < TEST_THREADS; i++) {
+#if defined(_WIN32)
+            WaitForSingleObject(threads[i], INFINITE);
+            CloseHandle(threads[i]);
+#else
+            pthread_join(threads[i], NULL);
+#endif
+        }
+
+        uint32_t live = 0;
+        for (int i = 0; i < TEST_THREADS; i++)
+            live += (uint32_t)runs[i].count;
+        CHECK((uint32_t)atlas->vtex_count == live);
+        CHECK(atlas_get_width(atlas) == 1024 && atlas_get_height(atlas) == 512);
+        check_atlas(atlas, backend);
+
+        atlas_destroy(atlas);
+        printf("threads backend=%s ok\n", backend_names[backend]);
+    }
+}
+
+int main(void)
+{
+    test_release();
+    test_grow();
+    test_arenas();
+    test_threads();
+    return 0;
+}
@@ -1,55 +1,800 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <limits.h>
 
 #include "texture_atlas.h"
 
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+// Hole kernels use the widest of AVX2, SSE2 and NEON the compiler targets.
+// Define ATLAS_NO_SIMD to fall back to plain loops.
+#if !defined(ATLAS_NO_SIMD) && defined(__AVX2__)
+#define ATLAS_SIMD_AVX2
+#include <immintrin.h>
+#elif !defined(ATLAS_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define ATLAS_SIMD_SSE2
+#include <emmintrin.h>
+#elif !defined(ATLAS_NO_SIMD) && (defined(__aarch64__) || defined(_M_ARM64))
+#define ATLAS_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
 #define ATLAS_MIN_RESERVED_HOLES 32
 #define ATLAS_MIN_RESERVED_VTEXES 32
 
+// Merges attempted when releasing space before falling back to a full rebuild.
+#define ATLAS_MAX_RELEASE_MERGES 256
+
+// Textures a single compaction step tries to move, keeping its cost bounded.
+#define ATLAS_COMPACT_ATTEMPTS 8
+
+// Serialized atlas blobs start with a magic and a format version.
+#define ATLAS_BLOB_MAGIC "ATLS"
+#define ATLAS_BLOB_VERSION 4
+#define ATLAS_BLOB_HEADER_SIZE 27
+#define ATLAS_BLOB_VTEX_SIZE 17
+#define ATLAS_BLOB_HOLE_SIZE 8
+#define ATLAS_BLOB_SEGMENT_SIZE 6
+
+// Hole and virtual texture indices, as well as their counts, are 16-bit so
+// the per-element metadata stays compact. Build with ATLAS_LARGE_CAPACITY to
+// go past 65535 holes or virtual textures.
+#ifdef ATLAS_LARGE_CAPACITY
+typedef uint32_t AtlasIndex;
+#define ATLAS_MAX_CAPACITY (1u << 30)
+#define ATLAS_NIL_INDEX UINT32_MAX
+#else
+typedef uint16_t AtlasIndex;
+#define ATLAS_MAX_CAPACITY UINT16_MAX
+#define ATLAS_NIL_INDEX UINT16_MAX
+#endif
+
+// Holes are bucketed by the power-of-two class of their width and height.
+#define ATLAS_SIZE_CLASSES 16
+#define ATLAS_NIL_HOLE ATLAS_NIL_INDEX
+
+// Shelf heights are rounded up to multiples of this many texels.
+#define ATLAS_SHELF_GRANULARITY 4
+#define ATLAS_NIL_SHELF UINT16_MAX
+
+// Virtual texture ids are handles, the slot index in the low bits and the
+// slot generation above them. Generations start at 1, so no id is ever 0, and
+// get bumped whenever a slot is freed so stale ids stop matching. Large
+// capacity builds trade generation bits for up to 16M virtual textures.
+#define ATLAS_INVALID_VTEX_ID 0
+#ifdef ATLAS_LARGE_CAPACITY
+#define ATLAS_SLOT_BITS 24
+#define ATLAS_MAX_VTEXES (1u << ATLAS_SLOT_BITS)
+#else
+#define ATLAS_SLOT_BITS 16
+#define ATLAS_MAX_VTEXES ATLAS_MAX_CAPACITY
+#endif
+#define ATLAS_SLOT_MASK ((1u << ATLAS_SLOT_BITS) - 1)
+#define ATLAS_MAX_GENERATION ((1u << (32 - ATLAS_SLOT_BITS)) - 1)
+
+/**
+ * Locks and atomics backing concurrent atlases. SRW locks and interlocked
+ * operations on Windows, pthreads and the GCC/Clang atomic builtins anywhere
+ * else. Loads acquire and stores release.
+ **/
+#if defined(_WIN32)
+typedef SRWLOCK AtlasMutex;
+
+static int atlas_mutex_init(AtlasMutex *mutex)
+{
+    InitializeSRWLock(mutex);
+    return 1;
+}
+
+static void atlas_mutex_destroy(AtlasMutex *mutex)
+{
+    (void)mutex;
+}
+
+static void atlas_mutex_lock(AtlasMutex *mutex)
+{
+    AcquireSRWLockExclusive(mutex);
+}
+
+static int atlas_mutex_trylock(AtlasMutex *mutex)
+{
+    return TryAcquireSRWLockExclusive(mutex) != 0;
+}
+
+static void atlas_mutex_unlock(AtlasMutex *mutex)
+{
+    ReleaseSRWLockExclusive(mutex);
+}
+
+static uint32_t atlas_atomic_load(uint32_t *value)
+{
+    return (uint32_t)InterlockedCompareExchange((volatile LONG*)value, 0, 0);
+}
+
+static void atlas_atomic_store(uint32_t *value, uint32_t v)
+{
+    InterlockedExchange((volatile LONG*)value, (LONG)v);
+}
+
+static uint16_t atlas_atomic_load16(uint16_t *value)
+{
+    return (uint16_t)InterlockedCompareExchange16((volatile SHORT*)value, 0, 0);
+}
+
+static void atlas_atomic_store16(uint16_t *value, uint16_t v)
+{
+    InterlockedExchange16((volatile SHORT*)value, (SHORT)v);
+}
+
+static uint32_t atlas_atomic_increment(uint32_t *value)
+{
+    return (uint32_t)InterlockedIncrement((volatile LONG*)value);
+}
+
+static void *atlas_atomic_load_ptr(void **value)
+{
+    return InterlockedCompareExchangePointer((PVOID volatile*)value, NULL, NULL);
+}
+
+static void atlas_atomic_store_ptr(void **value, void *v)
+{
+    InterlockedExchangePointer((PVOID volatile*)value, v);
+}
+
+static void atlas_atomic_fence(void)
+{
+    MemoryBarrier();
+}
+#else
+typedef pthread_mutex_t AtlasMutex;
+
+static int atlas_mutex_init(AtlasMutex *mutex)
+{
+    return pthread_mutex_init(mutex, NULL) == 0;
+}
+
+static void atlas_mutex_destroy(AtlasMutex *mutex)
+{
+    pthread_mutex_destroy(mutex);
+}
+
+static void atlas_mutex_lock(AtlasMutex *mutex)
+{
+    pthread_mutex_lock(mutex);
+}
+
+static int atlas_mutex_trylock(AtlasMutex *mutex)
+{
+    return pthread_mutex_trylock(mutex) == 0;
+}
+
+static void atlas_mutex_unlock(AtlasMutex *mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
+static uint32_t atlas_atomic_load(uint32_t *value)
+{
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static void atlas_atomic_store(uint32_t *value, uint32_t v)
+{
+    __atomic_store_n(value, v, __ATOMIC_RELEASE);
+}
+
+static uint16_t atlas_atomic_load16(uint16_t *value)
+{
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static void atlas_atomic_store16(uint16_t *value, uint16_t v)
+{
+    __atomic_store_n(value, v, __ATOMIC_RELEASE);
+}
+
+static uint32_t atlas_atomic_increment(uint32_t *value)
+{
+    return __atomic_add_fetch(value, 1, __ATOMIC_RELAXED);
+}
+
+static void *atlas_atomic_load_ptr(void **value)
+{
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static void atlas_atomic_store_ptr(void **value, void *v)
+{
+    __atomic_store_n(value, v, __ATOMIC_RELEASE);
+}
+
+static void atlas_atomic_fence(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+#endif
+
+/**
+ * Metadata allocators. Atlases allocate through the C library unless given
+ * callbacks, or a buffer to carve a heap out of. Heap blocks are handed out
+ * first fit from an address ordered free list, and merged back with their
+ * free neighbours when given back. Block sizes are rounded up to
+ * ATLAS_HEAP_ALIGN, which must fit a free block header.
+ **/
+#define ATLAS_HEAP_ALIGN 16
+
+typedef struct HeapBlock {
+    size_t size;
+    struct HeapBlock *next;
+} HeapBlock;
+
+typedef struct AtlasHeap {
+    AtlasMutex lock;
+    int concurrent;
+    HeapBlock *free_blocks;
+} AtlasHeap;
+
+static void *atlas_default_alloc(size_t size, void *user)
+{
+    (void)user;
+    return malloc(size);
+}
+
+static void *atlas_default_realloc(void *ptr, size_t old_size, size_t size, void *user)
+{
+    (void)old_size;
+    (void)user;
+    return realloc(ptr, size);
+}
+
+static void atlas_default_free(void *ptr, size_t size, void *user)
+{
+    (void)size;
+    (void)user;
+    free(ptr);
+}
+
+static const AtlasAllocator atlas_default_allocator = {
+    atlas_default_alloc, atlas_default_realloc, atlas_default_free, NULL
+};
+
+static inline size_t atlas_heap_round(size_t size)
+{
+    if (!size)
+        return ATLAS_HEAP_ALIGN;
+    return (size + ATLAS_HEAP_ALIGN - 1) & ~(size_t)(ATLAS_HEAP_ALIGN - 1);
+}
+
+/**
+ * Private, sets up a heap at the start of a buffer, the rest of the buffer
+ * making up a single free block.
+ * @arg buffer: Memory to carve the heap out of.
+ * @arg size: Size of the buffer in bytes.
+ * @arg concurrent: Whether the heap is used from several threads.
+ * @return: Pointer to the heap, NULL if the buffer is too small.
+ **/
+static AtlasHeap *atlas_heap_init(void *buffer, size_t size, int concurrent)
+{
+    uintptr_t start = ((uintptr_t)buffer + ATLAS_HEAP_ALIGN - 1) & ~(uintptr_t)(ATLAS_HEAP_ALIGN - 1);
+    uintptr_t end = ((uintptr_t)buffer + size) & ~(uintptr_t)(ATLAS_HEAP_ALIGN - 1);
+    size_t header = atlas_heap_round(sizeof(AtlasHeap));
+    if (!buffer || end < start + header + ATLAS_HEAP_ALIGN)
+        return NULL;
+
+    AtlasHeap *heap = (AtlasHeap*)start;
+    heap->concurrent = concurrent;
+    if (concurrent && !atlas_mutex_init(&heap->lock))
+        return NULL;
+
+    heap->free_blocks = (HeapBlock*)(start + header);
+    heap->free_blocks->size = end - start - header;
+    heap->free_blocks->next = NULL;
+    return heap;
+}
+
+/**
+ * Private, takes the first free block large enough, splitting off the rest.
+ * Must hold the heap lock.
+ * @arg heap: Heap to allocate from.
+ * @arg size: Rounded size of the block.
+ * @return: Pointer to the block, NULL if no free block is large enough.
+ **/
+static void *atlas_heap_take(AtlasHeap *heap, size_t size)
+{
+    HeapBlock **link = &heap->free_blocks;
+    while (*link && (*link)->size < size)
+        link = &(*link)->next;
+
+    HeapBlock *block = *link;
+    if (!block)
+        return NULL;
+
+    if (block->size == size) {
+        *link = block->next;
+    } else {
+        HeapBlock *rest = (HeapBlock*)((char*)block + size);
+        rest->size = block->size - size;
+        rest->next = block->next;
+        *link = rest;
+    }
+    return block;
+}
+
+/**
+ * Private, gives a block back, merging it with the free blocks right before
+ * and after it. Must hold the heap lock.
+ * @arg heap: Heap the block was taken from.
+ * @arg ptr: Start of the block.
+ * @arg size: Rounded size of the block.
+ **/
+static void atlas_heap_give(AtlasHeap *heap, void *ptr, size_t size)
+{
+    HeapBlock *block = (HeapBlock*)ptr, *prev = NULL;
+    HeapBlock **link = &heap->free_blocks;
+    while (*link && (char*)*link < (char*)block) {
+        prev = *link;
+        link = &prev->next;
+    }
+
+    block->size = size;
+    block->next = *link;
+    if (block->next && (char*)block + block->size == (char*)block->next) {
+        block->size += block->next->size;
+        block->next = block->next->next;
+    }
+
+    if (prev && (char*)prev + prev->size == (char*)block) {
+        prev->size += block->size;
+        prev->next = block->next;
+    } else {
+        *link = block;
+    }
+}
+
+/**
+ * Private, grows a block in place over the free block right after it. Must
+ * hold the heap lock.
+ * @arg heap: Heap the block was taken from.
+ * @arg ptr: Start of the block.
+ * @arg old_size: Current rounded size of the block.
+ * @arg size: Rounded size to grow it to.
+ * @return: 1 on success, 0 if the following space isn't free or too small.
+ **/
+static int atlas_heap_extend(AtlasHeap *heap, void *ptr, size_t old_size, size_t size)
+{
+    char *end = (char*)ptr + old_size;
+    HeapBlock **link = &heap->free_blocks;
+    while (*link && (char*)*link < end)
+        link = &(*link)->next;
+
+    HeapBlock *next = *link;
+    size_t extra = size - old_size;
+    if (!next || (char*)next != end || next->size < extra)
+        return 0;
+
+    HeapBlock *after = next->next;
+    size_t left = next->size - extra;
+    if (!left) {
+        *link = after;
+    } else {
+        HeapBlock *rest = (HeapBlock*)(end + extra);
+        rest->size = left;
+        rest->next = after;
+        *link = rest;
+    }
+    return 1;
+}
+
+static void *atlas_heap_alloc(size_t size, void *user)
+{
+    AtlasHeap *heap = (AtlasHeap*)user;
+    if (heap->concurrent)
+        atlas_mutex_lock(&heap->lock);
+    void *ptr = atlas_heap_take(heap, atlas_heap_round(size));
+    if (heap->concurrent)
+        atlas_mutex_unlock(&heap->lock);
+    return ptr;
+}
+
+static void *atlas_heap_realloc(void *ptr, size_t old_size, size_t size, void *user)
+{
+    AtlasHeap *heap = (AtlasHeap*)user;
+    old_size = atlas_heap_round(old_size);
+    size = atlas_heap_round(size);
+    if (heap->concurrent)
+        atlas_mutex_lock(&heap->lock);
+
+    // Shrink or grow in place when possible, move the block otherwise.
+    void *moved = ptr;
+    if (size < old_size) {
+        atlas_heap_give(heap, (char*)ptr + size, old_size - size);
+    } else if (size > old_size && !atlas_heap_extend(heap, ptr, old_size, size)) {
+        moved = atlas_heap_take(heap, size);
+        if (moved) {
+            memcpy(moved, ptr, old_size);
+            atlas_heap_give(heap, ptr, old_size);
+        }
+    }
+
+    if (heap->concurrent)
+        atlas_mutex_unlock(&heap->lock);
+    return moved;
+}
+
+static void atlas_heap_free(void *ptr, size_t size, void *user)
+{
+    AtlasHeap *heap = (AtlasHeap*)user;
+    if (heap->concurrent)
+        atlas_mutex_lock(&heap->lock);
+    atlas_heap_give(heap, ptr, atlas_heap_round(size));
+    if (heap->concurrent)
+        atlas_mutex_unlock(&heap->lock);
+}
+
+static void *atlas_mem_alloc(const AtlasAllocator *allocator, size_t size)
+{
+    return allocator->alloc(size, allocator->user);
+}
+
+static void *atlas_mem_calloc(const AtlasAllocator *allocator, size_t size)
+{
+    void *ptr = allocator->alloc(size, allocator->user);
+    if (ptr)
+        memset(ptr, 0, size);
+    return ptr;
+}
+
+/**
+ * Private, resizes a block, copying it over when the allocator has no
+ * realloc callback. The block is left untouched on failure.
+ **/
+static void *atlas_mem_realloc(const AtlasAllocator *allocator, void *ptr, size_t old_size, size_t size)
+{
+    if (!ptr)
+        return allocator->alloc(size, allocator->user);
+    if (allocator->realloc)
+        return allocator->realloc(ptr, old_size, size, allocator->user);
+
+    void *moved = allocator->alloc(size, allocator->user);
+    if (moved) {
+        memcpy(moved, ptr, old_size < size ? old_size : size);
+        allocator->free(ptr, old_size, allocator->user);
+    }
+    return moved;
+}
+
+static void atlas_mem_free(const AtlasAllocator *allocator, void *ptr, size_t size)
+{
+    if (ptr)
+        allocator->free(ptr, size, allocator->user);
+}
+
 // Trivial Rectangle, containing either free space or a virtual texture.
 typedef struct Rect {
     uint16_t left, up;
     uint16_t right, down;
 } Rect;
 
+/**
+ * Intrusive doubly linked list node, one per hole, chaining all holes that
+ * share the same size class bucket.
+ **/
+typedef struct HoleLink {
+    AtlasIndex prev, next;
+} HoleLink;
+
+/**
+ * Bounds matched by hole kernels, a hole matches when its left and up edges
+ * lie at or before max_left and max_up, and its right and down edges at or
+ * past min_right and min_down. Overlap, contact and containment tests all
+ * take this form.
+ **/
+typedef struct HoleQuery {
+    uint16_t max_left, max_up;
+    uint16_t min_right, min_down;
+} HoleQuery;
+
+/**
+ * Hole picked by a look-up, with the keys it was picked by, lower is better.
+ * Look-ups only replace it with a hole scoring strictly better, so a texture
+ * can be looked up in both orientations one after the other.
+ **/
+typedef struct HoleChoice {
+    AtlasIndex index;
+    int64_t primary, secondary;
+    int exact; // Set once no other hole can do better.
+} HoleChoice;
+
 /**
  * Contains virtual texture metadata. Actual texel is an implementation detail
  * of the library user.
  * @property rect: Rectangle containing the virtual texture and padding.
- * @property id: Unique identifier for the virtual texture.
- * @property invalidated: Tags virtual texture for deletion upon next upload.
+ * @property id: Unique identifier for the virtual texture, ATLAS_INVALID_VTEX_ID
+ *               while the slot is free.
+ * @property page: Index of the page the rect lies in.
+ * @property generation: Generation of the slot, part of the id it hands out.
  **/
 typedef struct VirtualTexture {
         Rect rect;
         uint32_t id;
-        int invalidated;
+        uint16_t page;
+        uint16_t generation;
+        uint8_t rotated; // Stored turned 90 degrees clockwise.
 } VirtualTexture;
 
+/**
+ * Skyline segment, the top edge of the packed area spanning [x, x + width).
+ **/
+typedef struct SkylineNode {
+    uint16_t x, y;
+    uint16_t width;
+} SkylineNode;
+
+/**
+ * Shelf backend row. Textures are packed left to right, and only the ones at
+ * the end of the row give their space back until the whole row empties.
+ * @property y: Top coordinate of the row.
+ * @property height: Row height, rounded up to the shelf granularity.
+ * @property cursor: Left coordinate of the free space at the end of the row.
+ * @property live: Number of textures allocated in the row.
+ * @property next: Next shelf in the empty shelves list of its height.
+ * @property open: Height class the shelf is open for, or ATLAS_NIL_SHELF.
+ * @property stacked: Whether rebuilt textures start below the row top, then
+ *                    the row only gives space back once it empties.
+ **/
+typedef struct Shelf {
+    uint16_t y, height;
+    uint16_t cursor;
+    uint16_t live;
+    uint16_t next;
+    uint16_t open;
+    uint16_t stacked;
+} Shelf;
+
+/**
+ * Buddy backend quadtree node, covering a square block of 2^level texels per
+ * side. Leaves are either wholly free or wholly used.
+ * @property children: Index of the first of four consecutive children, in
+ *                     top-left, top-right, bottom-left, bottom-right order,
+ *                     or 0 for leaves.
+ * @property largest: Level of the largest free block within, -1 if none.
+ **/
+typedef struct QuadNode {
+    uint32_t children;
+    int8_t largest;
+} QuadNode;
+
+/**
+ * Batch allocation entry, placed in decreasing key order. Compaction sorts
+ * virtual textures with them too.
+ * @property key: Sort key computed from the texture dimensions.
+ * @property item: Index of the texture within the batch.
+ **/
+typedef struct BatchEntry {
+    uint64_t key;
+    size_t item;
+} BatchEntry;
+
+/**
+ * Array a concurrent atlas grew out of, kept until the atlas is destroyed.
+ **/
+typedef struct RetiredArray {
+    void *ptr;
+    size_t size;
+} RetiredArray;
+
+/**
+ * Packing backend operations, each backend tracks free space its own way.
+ * @property init: Reserves backend structures and marks the page as free.
+ * @property reset: Marks the whole page as free.
+ * @property allocate: Finds and occupies space for a (w, h) rect, or a (h, w)
+ *                    one if rotate is set and that fits better.
+ * @property occupy: Marks a given free rect as used, used to rebuild the
+ *                  backend and to retire arenas.
+ * @property release: Returns a rect to the free space, 0 if a rebuild is needed.
+ * @property measure: Counts the free rects tracked, and finds the largest one.
+ * @property prepare_grow: Reserves what a larger page takes, 0 if out of memory.
+ * @property grow: Hands the space past the previous page size over to the free
+ *                 space once the page got larger, may ask for a rebuild.
+ * @property adopt: Optional, releases the free rects of a retired arena's
+ *                  private backend into the page, keeping the layout the
+ *                  arena packed with, 0 if a rebuild is needed. Without it,
+ *                  retiring releases the whole arena and occupies the
+ *                  textures left in it again.
+ **/
+typedef struct AtlasBackendOps {
+    int (*init)(Atlas *atlas);
+    void (*reset)(Atlas *atlas);
+    int (*allocate)(Atlas *atlas, int w, int h, int rotate, Rect *rect);
+    int (*occupy)(Atlas *atlas, Rect *rect);
+    int (*release)(Atlas *atlas, Rect *rect);
+    void (*measure)(Atlas *atlas, uint32_t *hole_count, uint16_t *largest);
+    int (*prepare_grow)(Atlas *atlas, int width, int height);
+    void (*grow)(Atlas *atlas, int width, int height);
+    int (*adopt)(Atlas *atlas, Atlas *space, const Rect *region);
+} AtlasBackendOps;
+
 typedef struct Atlas {
+    const AtlasBackendOps *backend; // Packing algorithm in use.
+    int invalidated; // Whether the backend must be rebuilt from the vtexes.
+
+    /**
+     * MaxRects and Guillotine backends. Holes describe areas in the atlas that
+     * are empty. With MaxRects a hole can overlap other holes, but not fully
+     * contain another; with Guillotine holes never overlap. Each edge of the
+     * holes gets its own column, so kernels test consecutive holes at once;
+     * the columns share a single block starting at hole_left.
+     **/
+    uint16_t *hole_left, *hole_up;
+    uint16_t *hole_right, *hole_down;
+    int hole_count; // Currently created holes.
+    int hole_reserved;
+
+    /**
+     * Secondary index over holes. Bucket (cw, ch) chains every hole whose
+     * width lies in [2^cw, 2^(cw+1)) and height in [2^ch, 2^(ch+1)), so a
+     * best-fit query only visits buckets that can possibly fit a texture.
+     **/
+    HoleLink *hole_links;
+    AtlasIndex hole_buckets[ATLAS_SIZE_CLASSES][ATLAS_SIZE_CLASSES];
+    int hole_bucket_sizes[ATLAS_SIZE_CLASSES][ATLAS_SIZE_CLASSES]; // Holes chained in each bucket.
+    AtlasHeuristic heuristic; // Rule picking the hole a texture is placed in.
+
+    /**
+     * Scratch space for holes pending emplacement, generated either by a
+     * split or by merges while releasing space.
+     **/
+    Rect *pending_holes;
+    int pending_reserved;
+    AtlasIndex *touching_holes; // Scratch indices of holes touching a merge.
+
+    /**
+     * Skyline backend. Segments sorted by x, covering the page width, with
+     * everything below a segment considered used.
+     **/
+    SkylineNode *skyline;
+    int skyline_count;
+    int skyline_reserved;
+
+    /**
+     * Shelf backend. Rows are opened from the top of the page down, each
+     * height class packs into its open shelf, and emptied shelves are kept
+     * per height class for reuse. shelf_rows maps every row shelves cover
+     * to its shelf.
+     **/
+    Shelf *shelves;
+    int shelf_count;
+    int shelf_reserved;
+    int shelf_classes;
+    uint16_t *shelf_open;
+    uint16_t *shelf_empty;
+    uint16_t *shelf_rows;
+    uint16_t shelf_bottom; // Top coordinate of the never used space.
+
     /**
-     * Holes describe areas in the atlas that are empty. A hole can overlap
-     * other holes, but not fully contain another.
+     * Buddy backend. Quadtree over the smallest power-of-two square covering
+     * the page, anything outside of the page is marked as used. Groups of
+     * four unused nodes are chained through their first node's children.
      **/
-    Rect *holes;
-    uint16_t hole_count; // Currently created holes.
-    uint16_t hole_reserved; 
-    int holes_invalidated; // Whether the hole structure was invalidated.
+    QuadNode *quad_nodes;
+    uint32_t quad_count;
+    uint32_t quad_reserved;
+    uint32_t quad_free; // First unused group of four nodes, 0 if none.
+    uint32_t quad_holes; // Free leaves.
+    int quad_levels;    // Level of the root node.
 
+    uint64_t used_area;   // Area allocated to virtual textures and arenas, padding included.
+    uint64_t wasted_area; // Area reserved by the backend past what was requested.
+    uint64_t padding_area; // Padding of every virtual texture with space, owner only.
+
+    /**
+     * Arenas carved out of this page and not retired yet. Rebuilds keep
+     * them occupied as a whole, along with the textures they hold.
+     **/
+    Rect *arenas;
+    int arena_count;
+    int arena_reserved;
+
+    /**
+     * Pages. Every page is an Atlas of its own, but only the first one, the
+     * owner, holds virtual textures and ids, along with the page list. Pages
+     * use their owner's vtexes whenever they need to walk the textures they
+     * hold, and track their own used and wasted area.
+     **/
+    Atlas *owner;
+    Atlas **pages;        // Every page by index, owner only.
+    Atlas **ranked_pages; // Every page in allocation order, owner only.
+    uint16_t page;               // Index of this page.
+    uint16_t page_rank;          // Position of this page in ranked_pages.
+    uint16_t page_count;
+    uint16_t max_pages;
+    AtlasPageOrder page_order;
+
+    /**
+     * Concurrent atlases. Every page lock guards the page backend and used
+     * area, the owner meta_lock guards virtual textures, ids and the page
+     * list, and page locks are always taken first. New pages are the only
+     * exception, they're locked under the meta lock before anyone else can
+     * reach them. Writes to virtual textures and to the page size are
+     * wrapped by odd vtex_seq values, so coordinate look-ups run without
+     * locking and retry whenever a write overlapped them. Arrays walked by
+     * those look-ups are retired instead of freed when they grow.
+     **/
+    int concurrent;
+    AtlasMutex lock;
+    AtlasMutex meta_lock;
+    uint32_t vtex_seq;
+    uint32_t page_cursor; // Page the next allocating thread starts at.
+    uint64_t compact_cursor; // Compaction key atlas_compact_step resumes below.
+    uint32_t compact_moves;  // Moves made by compaction steps in the current pass.
+    int compact_idle;        // Whether the last pass moved nothing, until space gets freed.
+    AtlasTraceWrite trace_write; // Receives recorded calls, NULL unless tracing.
+    void *trace_user;
+    RetiredArray *retired;
+    int retired_count;
+    int retired_reserved;
 
     /**
      * Virtual Textures meta-data. Describes how and where texel data is pinned 
-     * to the altas page.
+     * to the altas page. Ids index their slot directly, freed slots are kept
+     * on a stack and handed out again before any new one.
      **/
     VirtualTexture *vtexes;
-    uint16_t vtex_count;
-    uint16_t vtex_last_id;
-    uint16_t vtex_reserved;
+    int vtex_count;      // Live virtual textures.
+    int vtex_slot_count; // Slots handed out so far, live or free.
+    int vtex_reserved;
+    AtlasIndex *vtex_free;
+    int vtex_free_count;
+
+    /**
+     * Allocator of every metadata array, shared by the pages and arenas of
+     * an atlas. The owner keeps the heap set up in the caller buffer, if any.
+     **/
+    AtlasAllocator allocator;
+    AtlasHeap *heap;
 
     uint16_t padding; // Padding to be added to the borders of every virtual texture.
-    uint16_t dimensions; // Atlas page dimensions.
+    uint16_t width;  // Atlas page width.
+    uint16_t height; // Atlas page height.
 } Atlas;
 
+/**
+ * Texture placed in an arena, with its rect in arena coordinates.
+ **/
+typedef struct ArenaTexture {
+    uint32_t id;
+    Rect rect;
+} ArenaTexture;
+
+/**
+ * Region of a page reserved by a single thread. Textures are packed in it by
+ * a private backend working in arena coordinates, so no page gets locked.
+ * @property owner: Pointer to the atlas owning the page.
+ * @property page: Pointer to the page the arena lies in.
+ * @property space: Private backend state, as an atlas page sized to the arena,
+ *                  without an owner or textures, in arena coordinates.
+ * @property rect: Space reserved in the page.
+ * @property textures: Textures placed in the arena, some maybe destroyed since.
+ **/
+struct AtlasArena {
+    Atlas *owner;
+    Atlas *page;
+    Atlas *space;
+    Rect rect;
+    ArenaTexture *textures;
+    int texture_count;
+    int texture_reserved;
+};
+
 static inline int rect_width(Rect *rect)
 {
     int val = rect->right - rect->left;
@@ -62,9 +807,38 @@ static inline int rect_height(Rect *rect)
     return val < 0 ? 0 : val;
 }
 
-static inline int rect_area(Rect *rect)
+static inline uint32_t rect_area(Rect *rect)
+{
+    return (uint32_t)rect_width(rect) * rect_height(rect);
+}
+
+static inline uint32_t rect_padding_area(Rect *rect, int padding)
+{
+    if (rect_area(rect) == 0)
+        return 0;
+    return rect_area(rect) - (uint32_t)(rect_width(rect) - padding * 2) * (rect_height(rect) - padding * 2);
+}
+
+/**
+ * Private, gathers a hole from the edge columns.
+ **/
+static inline void atlas_load_hole(const Atlas *atlas, int index, Rect *hole)
+{
+    hole->left = atlas->hole_left[index];
+    hole->up = atlas->hole_up[index];
+    hole->right = atlas->hole_right[index];
+    hole->down = atlas->hole_down[index];
+}
+
+/**
+ * Private, scatters a hole into the edge columns.
+ **/
+static inline void atlas_store_hole(Atlas *atlas, int index, const Rect *hole)
 {
-    return rect_width(rect) * rect_height(rect);
+    atlas->hole_left[index] = hole->left;
+    atlas->hole_up[index] = hole->up;
+    atlas->hole_right[index] = hole->right;
+    atlas->hole_down[index] = hole->down;
 }
 
 /**
@@ -75,414 +849,4173 @@ static inline int rect_area(Rect *rect)
  **/
 static int atlas_lookup_vtex_id(Atlas *atlas, uint32_t id)
 {
-    int i;
-    for (i = 0; i < atlas->vtex_count; i++) {
-        if (atlas->vtexes[i].id == id)
-            break;
+    // Free slots hold no id, and stale ids carry an older generation.
+    uint32_t slot = id & ATLAS_SLOT_MASK;
+    if (id == ATLAS_INVALID_VTEX_ID || slot >= (uint32_t)atlas->vtex_slot_count ||
+        atlas->vtexes[slot].id != id)
+        return -1;
+
+    return slot;
+}
+
+/**
+ * Private, copies a virtual texture out of the atlas. Concurrent atlases do
+ * so without locking, retrying whenever a write overlapped the copy.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg id: Unique virtual texture identifier.
+ * @arg vt: Pointer to retrieve the virtual texture.
+ * @arg size: Optional, pointer to retrieve the page width and height at the
+ *            time of the copy, so pages growing meanwhile can't mismatch it.
+ * @return: 1 if virtual texture id is valid, 0 otherwise.
+ **/
+static int atlas_read_vtex(Atlas *atlas, uint32_t id, VirtualTexture *vt, uint16_t *size)
+{
+    if (!atlas->concurrent) {
+        int index;
+        if ((index = atlas_lookup_vtex_id(atlas, id)) == -1)
+            return 0;
+        *vt = atlas->vtexes[index];
+        if (size) {
+            size[0] = atlas->width;
+            size[1] = atlas->height;
+        }
+        return 1;
+    }
+
+    if (id == ATLAS_INVALID_VTEX_ID)
+        return 0;
+
+    for (;;) {
+        uint32_t seq = atlas_atomic_load(&atlas->vtex_seq);
+        if (seq & 1)
+            continue;
+
+        // Capacities are published after the arrays they bound and never
+        // shrink, so reading them first keeps torn reads in bounds. Slots
+        // past the ones handed out are zeroed, so their id never matches.
+        uint32_t reserved = atlas_atomic_load((uint32_t*)&atlas->vtex_reserved);
+        VirtualTexture *vtexes = (VirtualTexture*)atlas_atomic_load_ptr((void**)&atlas->vtexes);
+
+        int found = 0;
+        uint32_t slot = id & ATLAS_SLOT_MASK;
+        if (slot < reserved) {
+            *vt = vtexes[slot];
+            found = 1;
+        }
+        if (size) {
+            size[0] = atlas_atomic_load16(&atlas->width);
+            size[1] = atlas_atomic_load16(&atlas->height);
+        }
+
+        atlas_atomic_fence();
+        if (atlas_atomic_load(&atlas->vtex_seq) == seq)
+            return found && vt->id == id;
+    }
+}
+
+/**
+ * Private, marks the start of a write to virtual textures or their index,
+ * making concurrent look-ups retry. Must hold the meta lock.
+ * @arg atlas: Pointer to atlas structure.
+ **/
+static void atlas_write_begin(Atlas *atlas)
+{
+    if (!atlas->concurrent)
+        return;
+    atlas_atomic_store(&atlas->vtex_seq, atlas->vtex_seq + 1);
+    atlas_atomic_fence();
+}
+
+/**
+ * Private, marks the end of a write started by atlas_write_begin.
+ * @arg atlas: Pointer to atlas structure.
+ **/
+static void atlas_write_end(Atlas *atlas)
+{
+    if (atlas->concurrent)
+        atlas_atomic_store(&atlas->vtex_seq, atlas->vtex_seq + 1);
+}
+
+/**
+ * Private, page and meta lock helpers, no-ops unless the atlas is concurrent.
+ * @arg atlas: Pointer to atlas structure.
+ **/
+static void atlas_lock(Atlas *atlas)
+{
+    if (atlas->concurrent)
+        atlas_mutex_lock(&atlas->lock);
+}
+
+static void atlas_unlock(Atlas *atlas)
+{
+    if (atlas->concurrent)
+        atlas_mutex_unlock(&atlas->lock);
+}
+
+static void atlas_lock_meta(Atlas *atlas)
+{
+    if (atlas->concurrent)
+        atlas_mutex_lock(&atlas->meta_lock);
+}
+
+static void atlas_unlock_meta(Atlas *atlas)
+{
+    if (atlas->concurrent)
+        atlas_mutex_unlock(&atlas->meta_lock);
+}
+
+/**
+ * Private, computes the power-of-two size class of a non-zero length.
+ * @arg length: Width or height of a rectangle.
+ * @returns: floor(log2(length)).
+ **/
+static inline int size_class(int length)
+{
+    int cls = 0;
+    while (length >>= 1)
+        cls++;
+    return cls;
+}
+
+#if defined(ATLAS_SIMD_AVX2) || defined(ATLAS_SIMD_SSE2)
+/**
+ * Private, finds the lowest set bit of a non-zero mask.
+ **/
+static inline int atlas_lowest_bit(uint32_t mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+/**
+ * Private, sets up a query matching the holes overlapping a rect.
+ * @arg query: Pointer to the query to fill.
+ * @arg rect: Rect holes must overlap.
+ * @returns: 0 if the rect is empty, no hole overlaps it then.
+ **/
+static int hole_query_overlap(HoleQuery *query, const Rect *rect)
+{
+    if (rect->right <= rect->left || rect->down <= rect->up)
+        return 0;
+
+    query->max_left = rect->right - 1;
+    query->max_up = rect->down - 1;
+    query->min_right = rect->left + 1;
+    query->min_down = rect->up + 1;
+    return 1;
+}
+
+/**
+ * Private, sets up a query matching the holes overlapping or touching a rect,
+ * including the ones it contains.
+ * @arg query: Pointer to the query to fill.
+ * @arg rect: Rect holes must touch.
+ **/
+static void hole_query_touch(HoleQuery *query, const Rect *rect)
+{
+    query->max_left = rect->right;
+    query->max_up = rect->down;
+    query->min_right = rect->left;
+    query->min_down = rect->up;
+}
+
+/**
+ * Private, hole kernel finding the next hole matching a query. Saturated
+ * differences between edges and bounds are zero wherever a bound holds, so
+ * a block of holes is tested with four subtractions and a comparison.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg start: Index of the first hole to be tested.
+ * @arg query: Bounds the hole must match.
+ * @returns: Index of the first matching hole, hole_count if none.
+ **/
+static int atlas_find_hole(const Atlas *atlas, int start, const HoleQuery *query)
+{
+    const uint16_t *left = atlas->hole_left, *up = atlas->hole_up;
+    const uint16_t *right = atlas->hole_right, *down = atlas->hole_down;
+    int i = start, count = atlas->hole_count;
+
+#if defined(ATLAS_SIMD_AVX2)
+    const __m256i max_left = _mm256_set1_epi16((short)query->max_left);
+    const __m256i max_up = _mm256_set1_epi16((short)query->max_up);
+    const __m256i min_right = _mm256_set1_epi16((short)query->min_right);
+    const __m256i min_down = _mm256_set1_epi16((short)query->min_down);
+    for (; i + 16 <= count; i += 16) {
+        __m256i miss = _mm256_or_si256(
+            _mm256_or_si256(_mm256_subs_epu16(_mm256_loadu_si256((const __m256i*)&left[i]), max_left),
+                            _mm256_subs_epu16(_mm256_loadu_si256((const __m256i*)&up[i]), max_up)),
+            _mm256_or_si256(_mm256_subs_epu16(min_right, _mm256_loadu_si256((const __m256i*)&right[i])),
+                            _mm256_subs_epu16(min_down, _mm256_loadu_si256((const __m256i*)&down[i]))));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi16(miss, _mm256_setzero_si256()));
+        if (mask)
+            return i + atlas_lowest_bit(mask) / 2;
+    }
+#elif defined(ATLAS_SIMD_SSE2)
+    const __m128i max_left = _mm_set1_epi16((short)query->max_left);
+    const __m128i max_up = _mm_set1_epi16((short)query->max_up);
+    const __m128i min_right = _mm_set1_epi16((short)query->min_right);
+    const __m128i min_down = _mm_set1_epi16((short)query->min_down);
+    for (; i + 8 <= count; i += 8) {
+        __m128i miss = _mm_or_si128(
+            _mm_or_si128(_mm_subs_epu16(_mm_loadu_si128((const __m128i*)&left[i]), max_left),
+                         _mm_subs_epu16(_mm_loadu_si128((const __m128i*)&up[i]), max_up)),
+            _mm_or_si128(_mm_subs_epu16(min_right, _mm_loadu_si128((const __m128i*)&right[i])),
+                         _mm_subs_epu16(min_down, _mm_loadu_si128((const __m128i*)&down[i]))));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi16(miss, _mm_setzero_si128()));
+        if (mask)
+            return i + atlas_lowest_bit(mask) / 2;
+    }
+#elif defined(ATLAS_SIMD_NEON)
+    const uint16x8_t max_left = vdupq_n_u16(query->max_left);
+    const uint16x8_t max_up = vdupq_n_u16(query->max_up);
+    const uint16x8_t min_right = vdupq_n_u16(query->min_right);
+    const uint16x8_t min_down = vdupq_n_u16(query->min_down);
+    for (; i + 8 <= count; i += 8) {
+        uint16x8_t hit = vandq_u16(
+            vandq_u16(vcleq_u16(vld1q_u16(&left[i]), max_left), vcleq_u16(vld1q_u16(&up[i]), max_up)),
+            vandq_u16(vcgeq_u16(vld1q_u16(&right[i]), min_right), vcgeq_u16(vld1q_u16(&down[i]), min_down)));
+
+        // The scalar loop below pins down which hole matched.
+        if (vmaxvq_u16(hit))
+            break;
+    }
+#endif
+
+    for (; i < count; i++) {
+        if (left[i] <= query->max_left && up[i] <= query->max_up &&
+            right[i] >= query->min_right && down[i] >= query->min_down)
+            return i;
+    }
+
+    return count;
+}
+
+/**
+ * Private, hole kernel finding the next hole a (w, h) rect fits in, the same
+ * saturated differences test run on hole widths and heights.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg start: Index of the first hole to be tested.
+ * @arg w: Width, must be positive.
+ * @arg h: Height, must be positive.
+ * @returns: Index of the first hole fitting the rect, hole_count if none.
+ **/
+static int atlas_find_fit(const Atlas *atlas, int start, int w, int h)
+{
+    const uint16_t *left = atlas->hole_left, *up = atlas->hole_up;
+    const uint16_t *right = atlas->hole_right, *down = atlas->hole_down;
+    int i = start, count = atlas->hole_count;
+
+#if defined(ATLAS_SIMD_AVX2)
+    const __m256i min_w = _mm256_set1_epi16((short)w), min_h = _mm256_set1_epi16((short)h);
+    for (; i + 16 <= count; i += 16) {
+        __m256i width = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i*)&right[i]),
+                                         _mm256_loadu_si256((const __m256i*)&left[i]));
+        __m256i height = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i*)&down[i]),
+                                          _mm256_loadu_si256((const __m256i*)&up[i]));
+        __m256i miss = _mm256_or_si256(_mm256_subs_epu16(min_w, width), _mm256_subs_epu16(min_h, height));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi16(miss, _mm256_setzero_si256()));
+        if (mask)
+            return i + atlas_lowest_bit(mask) / 2;
+    }
+#elif defined(ATLAS_SIMD_SSE2)
+    const __m128i min_w = _mm_set1_epi16((short)w), min_h = _mm_set1_epi16((short)h);
+    for (; i + 8 <= count; i += 8) {
+        __m128i width = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)&right[i]),
+                                      _mm_loadu_si128((const __m128i*)&left[i]));
+        __m128i height = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)&down[i]),
+                                       _mm_loadu_si128((const __m128i*)&up[i]));
+        __m128i miss = _mm_or_si128(_mm_subs_epu16(min_w, width), _mm_subs_epu16(min_h, height));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi16(miss, _mm_setzero_si128()));
+        if (mask)
+            return i + atlas_lowest_bit(mask) / 2;
+    }
+#elif defined(ATLAS_SIMD_NEON)
+    const uint16x8_t min_w = vdupq_n_u16((uint16_t)w), min_h = vdupq_n_u16((uint16_t)h);
+    for (; i + 8 <= count; i += 8) {
+        uint16x8_t width = vsubq_u16(vld1q_u16(&right[i]), vld1q_u16(&left[i]));
+        uint16x8_t height = vsubq_u16(vld1q_u16(&down[i]), vld1q_u16(&up[i]));
+
+        // The scalar loop below pins down which hole matched.
+        if (vmaxvq_u16(vandq_u16(vcgeq_u16(width, min_w), vcgeq_u16(height, min_h))))
+            break;
+    }
+#endif
+
+    for (; i < count; i++) {
+        if (right[i] - left[i] >= w && down[i] - up[i] >= h)
+            return i;
+    }
+
+    return count;
+}
+
+/**
+ * Private, look-up the smallest possible rectangle where the texture fits.
+ * Buckets are visited in increasing order of their minimum possible area,
+ * and the search stops once no remaining bucket can beat the current best.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg w: Texture width.
+ * @arg h: Texture height.
+ * @arg best: Hole picked so far, replaced by any smaller hole found.
+ **/
+static void atlas_lookup_bestfit(Atlas *atlas, int w, int h, HoleChoice *best)
+{
+    if (w <= 0 || h <= 0 || w > UINT16_MAX || h > UINT16_MAX)
+        return;
+
+    uint32_t exact_area = (uint32_t)w * h;
+    int cw_min = size_class(w);
+    int ch_min = size_class(h);
+
+    for (int sum = cw_min + ch_min; sum <= (ATLAS_SIZE_CLASSES - 1) * 2; sum++) {
+        // Every hole in buckets with cw + ch == sum has area >= 2^sum.
+        if (((int64_t)1 << sum) >= best->primary)
+            break;
+
+        int cw_first = sum - (ATLAS_SIZE_CLASSES - 1);
+        if (cw_first < cw_min)
+            cw_first = cw_min;
+
+        for (int cw = cw_first; cw <= sum - ch_min && cw < ATLAS_SIZE_CLASSES; cw++) {
+            AtlasIndex i = atlas->hole_buckets[cw][sum - cw];
+            for (; i != ATLAS_NIL_HOLE; i = atlas->hole_links[i].next) {
+                Rect hole;
+                atlas_load_hole(atlas, i, &hole);
+                if (rect_width(&hole) < w || rect_height(&hole) < h)
+                    continue;
+
+                uint32_t area = rect_area(&hole);
+                if (area < best->primary) {
+                    best->index = i;
+                    best->primary = area;
+
+                    // Can't do better than an exact fit.
+                    if (area == exact_area) {
+                        best->exact = 1;
+                        return;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Private, measures how much of a strip one texel thick lies in holes. MaxRects
+ * holes may overlap, so spans covered by several holes are counted once.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg left: Left edge of the strip.
+ * @arg up: Top edge of the strip.
+ * @arg right: Right edge of the strip.
+ * @arg down: Bottom edge of the strip.
+ * @returns: Length of the strip that is free.
+ **/
+static int atlas_free_length(const Atlas *atlas, int left, int up, int right, int down)
+{
+    Rect strip = {left, up, right, down};
+    int vertical = right - left == 1;
+    int from = vertical ? up : left;
+    int to = vertical ? down : right;
+    int covered = 0;
+
+    // Extend the covered span from its end as far as the holes reach, or skip
+    // to the next hole starting past it.
+    while (from < to) {
+        Rect rest = strip;
+        if (vertical)
+            rest.up = from;
+        else
+            rest.left = from;
+
+        HoleQuery query;
+        if (!hole_query_overlap(&query, &rest))
+            break;
+
+        int reach = from, next = to;
+        for (int i = 0; (i = atlas_find_hole(atlas, i, &query)) < atlas->hole_count; i++) {
+            int start = vertical ? atlas->hole_up[i] : atlas->hole_left[i];
+            int end = vertical ? atlas->hole_down[i] : atlas->hole_right[i];
+            if (start <= from && end > reach)
+                reach = end;
+            else if (start > from && start < next)
+                next = start;
+        }
+
+        if (reach > from) {
+            reach = reach < to ? reach : to;
+            covered += reach - from;
+            from = reach;
+        } else {
+            from = next;
+        }
+    }
+
+    return covered;
+}
+
+/**
+ * Private, computes how much of the rect perimeter touches the page borders
+ * or used space. Whatever isn't covered by holes is used, so this only looks
+ * at the page's own holes, in the coordinates of the page or arena.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg rect: Candidate placement, at the top-left corner of its hole.
+ * @arg hole: Hole the rect is placed in.
+ * @returns: Length of the perimeter in contact.
+ **/
+static int atlas_contact_score(Atlas *atlas, const Rect *rect, const Rect *hole)
+{
+    int w = rect->right - rect->left, h = rect->down - rect->up;
+    int score = 0;
+
+    // Left and top sides lie on the hole edges, the right and bottom sides
+    // only when the rect fills the hole that way, else they face the hole.
+    if (rect->left == 0)
+        score += h;
+    else
+        score += h - atlas_free_length(atlas, rect->left - 1, rect->up, rect->left, rect->down);
+    if (rect->up == 0)
+        score += w;
+    else
+        score += w - atlas_free_length(atlas, rect->left, rect->up - 1, rect->right, rect->up);
+    if (rect->right == atlas->width)
+        score += h;
+    else if (rect->right == hole->right)
+        score += h - atlas_free_length(atlas, rect->right, rect->up, rect->right + 1, rect->down);
+    if (rect->down == atlas->height)
+        score += w;
+    else if (rect->down == hole->down)
+        score += w - atlas_free_length(atlas, rect->left, rect->down, rect->right, rect->down + 1);
+
+    return score;
+}
+
+/**
+ * Private, scores a hole under the atlas heuristic, placing the texture at its
+ * top-left corner, and keeps it if it beats the best so far. Scores are
+ * compared by a primary and then a secondary key, lower is better.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg index: Index of the hole.
+ * @arg w: Texture width.
+ * @arg h: Texture height.
+ * @arg best: Hole picked so far.
+ * @returns: 1 if the hole is an exact fit no other hole can beat, 0 otherwise.
+ **/
+static int atlas_score_hole(Atlas *atlas, AtlasIndex index, int w, int h, HoleChoice *best)
+{
+    Rect hole;
+    atlas_load_hole(atlas, index, &hole);
+    int leftover_w = rect_width(&hole) - w;
+    int leftover_h = rect_height(&hole) - h;
+    if (leftover_w < 0 || leftover_h < 0)
+        return 0;
+
+    int short_side = leftover_w < leftover_h ? leftover_w : leftover_h;
+    int long_side = leftover_w < leftover_h ? leftover_h : leftover_w;
+    int64_t primary, secondary;
+    switch (atlas->heuristic) {
+    case ATLAS_HEURISTIC_BEST_SHORT_SIDE:
+        primary = short_side;
+        secondary = long_side;
+        break;
+    case ATLAS_HEURISTIC_BEST_LONG_SIDE:
+        primary = long_side;
+        secondary = short_side;
+        break;
+    case ATLAS_HEURISTIC_BOTTOM_LEFT:
+        primary = hole.up + h;
+        secondary = hole.left;
+        break;
+    case ATLAS_HEURISTIC_CONTACT_POINT: {
+        Rect vtex = {hole.left, hole.up, hole.left + w, hole.up + h};
+        primary = -atlas_contact_score(atlas, &vtex, &hole);
+        secondary = rect_area(&hole);
+        break;
+    }
+    default:
+        primary = rect_area(&hole);
+        secondary = 0;
+        break;
+    }
+
+    if (primary < best->primary || (primary == best->primary && secondary < best->secondary)) {
+        best->index = index;
+        best->primary = primary;
+        best->secondary = secondary;
+
+        // Can't do better than an exact fit.
+        best->exact = !leftover_w && !leftover_h && atlas->heuristic != ATLAS_HEURISTIC_BOTTOM_LEFT &&
+                      atlas->heuristic != ATLAS_HEURISTIC_CONTACT_POINT;
+    }
+
+    return best->exact;
+}
+
+/**
+ * Private, look-up the hole scoring best under the atlas heuristic. Every
+ * bucket that can fit the texture is visited, unless an exact fit turns up
+ * first. Once those buckets chain most holes, e.g. small textures on a
+ * fragmented page, following the chains costs more than running the fit
+ * kernel over the hole columns, so the columns get scanned instead.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg w: Texture width.
+ * @arg h: Texture height.
+ * @arg best: Hole picked so far, replaced by any hole scoring better.
+ **/
+static void atlas_lookup_heuristic(Atlas *atlas, int w, int h, HoleChoice *best)
+{
+    if (w <= 0 || h <= 0 || w > UINT16_MAX || h > UINT16_MAX)
+        return;
+
+    int cw_min = size_class(w), ch_min = size_class(h), candidates = 0;
+
+    for (int cw = cw_min; cw < ATLAS_SIZE_CLASSES; cw++) {
+        for (int ch = ch_min; ch < ATLAS_SIZE_CLASSES; ch++)
+            candidates += atlas->hole_bucket_sizes[cw][ch];
+    }
+
+    if ((int64_t)candidates * 4 > (int64_t)atlas->hole_count * 3) {
+        int i = atlas_find_fit(atlas, 0, w, h);
+        for (; i < atlas->hole_count; i = atlas_find_fit(atlas, i + 1, w, h)) {
+            if (atlas_score_hole(atlas, (AtlasIndex)i, w, h, best))
+                return;
+        }
+        return;
+    }
+
+    for (int cw = cw_min; cw < ATLAS_SIZE_CLASSES; cw++) {
+        for (int ch = ch_min; ch < ATLAS_SIZE_CLASSES; ch++) {
+            AtlasIndex i = atlas->hole_buckets[cw][ch];
+            for (; i != ATLAS_NIL_HOLE; i = atlas->hole_links[i].next) {
+                if (atlas_score_hole(atlas, i, w, h, best))
+                    return;
+            }
+        }
+    }
+}
+
+/**
+ * Private, look-up the hole a texture goes into, according to the atlas
+ * heuristic. Turned textures only win when they score strictly better.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg w: Texture width.
+ * @arg h: Texture height.
+ * @arg rotate: Whether the texture may be turned, then looked up as (h, w).
+ * @arg rotated: Pointer to retrieve whether the hole was picked for (h, w).
+ * @returns: Index of the hole if successful, otherwise ATLAS_NIL_HOLE.
+ **/
+static AtlasIndex atlas_lookup_hole(Atlas *atlas, int w, int h, int rotate, int *rotated)
+{
+    HoleChoice best = {ATLAS_NIL_HOLE, INT64_MAX, INT64_MAX, 0};
+    void (*lookup)(Atlas*, int, int, HoleChoice*) = atlas->heuristic == ATLAS_HEURISTIC_BEST_AREA ?
+                                                    atlas_lookup_bestfit : atlas_lookup_heuristic;
+
+    lookup(atlas, w, h, &best);
+    *rotated = 0;
+    if (rotate && w != h && !best.exact) {
+        int64_t primary = best.primary, secondary = best.secondary;
+        lookup(atlas, h, w, &best);
+        *rotated = best.primary != primary || best.secondary != secondary;
+    }
+
+    return best.index;
+}
+
+/**
+ * Private, copy Rect b into a.
+ * @arg a: Rect to be overwriten.
+ * @arg b: Rect to be copied from, left intact.
+ **/
+static void rect_copy(Rect *a, const Rect *b)
+{
+    if (a == b)
+        return;
+
+    a->left = b->left;
+    a->up = b->up;
+    a->right = b->right;
+    a->down = b->down;
+}
+
+/**
+ * Private, computes the next capacity of an array indexed by AtlasIndex,
+ * doubling it up to ATLAS_MAX_CAPACITY.
+ * @arg reserved: Current capacity.
+ * @return: New capacity, or 0 if the array can't grow any further.
+ **/
+static uint32_t atlas_grow_capacity(uint32_t reserved)
+{
+    if (reserved >= ATLAS_MAX_CAPACITY)
+        return 0;
+    return reserved > ATLAS_MAX_CAPACITY / 2 ? ATLAS_MAX_CAPACITY : reserved * 2;
+}
+
+/**
+ * Private, reserves more atlas holes array space.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg reserved: Number of holes to be reserved.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_reserve_holes(Atlas *atlas, uint32_t reserved)
+{
+    // The three arrays are swapped in together, so they keep sharing
+    // hole_reserved as their size should any allocation fail.
+    const AtlasAllocator *allocator = &atlas->allocator;
+    uint16_t *columns = (uint16_t*)atlas_mem_alloc(allocator, sizeof(columns[0]) * 4 * reserved);
+    HoleLink *links = (HoleLink*)atlas_mem_alloc(allocator, sizeof(links[0]) * reserved);
+    AtlasIndex *touching = (AtlasIndex*)atlas_mem_alloc(allocator, sizeof(touching[0]) * reserved);
+    if (!columns || !links || !touching) {
+        atlas_mem_free(allocator, columns, sizeof(columns[0]) * 4 * reserved);
+        atlas_mem_free(allocator, links, sizeof(links[0]) * reserved);
+        atlas_mem_free(allocator, touching, sizeof(touching[0]) * reserved);
+        return 0;
+    }
+
+    if (atlas->hole_reserved) {
+        memcpy(&columns[0 * reserved], atlas->hole_left, sizeof(columns[0]) * atlas->hole_count);
+        memcpy(&columns[1 * reserved], atlas->hole_up, sizeof(columns[0]) * atlas->hole_count);
+        memcpy(&columns[2 * reserved], atlas->hole_right, sizeof(columns[0]) * atlas->hole_count);
+        memcpy(&columns[3 * reserved], atlas->hole_down, sizeof(columns[0]) * atlas->hole_count);
+        memcpy(links, atlas->hole_links, sizeof(links[0]) * atlas->hole_reserved);
+        memcpy(touching, atlas->touching_holes, sizeof(touching[0]) * atlas->hole_reserved);
+    }
+    atlas_mem_free(allocator, atlas->hole_left, sizeof(columns[0]) * 4 * atlas->hole_reserved);
+    atlas_mem_free(allocator, atlas->hole_links, sizeof(links[0]) * atlas->hole_reserved);
+    atlas_mem_free(allocator, atlas->touching_holes, sizeof(touching[0]) * atlas->hole_reserved);
+
+    atlas->hole_left = &columns[0 * reserved];
+    atlas->hole_up = &columns[1 * reserved];
+    atlas->hole_right = &columns[2 * reserved];
+    atlas->hole_down = &columns[3 * reserved];
+    atlas->hole_links = links;
+    atlas->touching_holes = touching;
+    atlas->hole_reserved = reserved;
+    return 1;
+}
+
+/**
+ * Private, reserves more space for holes pending emplacement.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg reserved: Number of pending holes to be reserved.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_reserve_pending_holes(Atlas *atlas, int reserved)
+{
+    Rect *pending_holes = (Rect*)atlas_mem_realloc(&atlas->allocator, atlas->pending_holes,
+                                                   sizeof(pending_holes[0]) * atlas->pending_reserved,
+                                                   sizeof(pending_holes[0]) * reserved);
+    if (!pending_holes)
+        return 0;
+
+    atlas->pending_holes = pending_holes;
+    atlas->pending_reserved = reserved;
+    return 1;
+}
+
+/**
+ * Private, links a hole into the size class bucket matching its dimensions.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg index: Index of the hole in the holes array.
+ **/
+static void atlas_link_hole(Atlas *atlas, AtlasIndex index)
+{
+    int cw = size_class(atlas->hole_right[index] - atlas->hole_left[index]);
+    int ch = size_class(atlas->hole_down[index] - atlas->hole_up[index]);
+    AtlasIndex *head = &atlas->hole_buckets[cw][ch];
+
+    atlas->hole_links[index].prev = ATLAS_NIL_HOLE;
+    atlas->hole_links[index].next = *head;
+    if (*head != ATLAS_NIL_HOLE)
+        atlas->hole_links[*head].prev = index;
+    *head = index;
+    atlas->hole_bucket_sizes[cw][ch]++;
+}
+
+/**
+ * Private, unlinks a hole from its size class bucket.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg index: Index of the hole in the holes array.
+ **/
+static void atlas_unlink_hole(Atlas *atlas, AtlasIndex index)
+{
+    HoleLink *link = &atlas->hole_links[index];
+    int cw = size_class(atlas->hole_right[index] - atlas->hole_left[index]);
+    int ch = size_class(atlas->hole_down[index] - atlas->hole_up[index]);
+
+    if (link->prev != ATLAS_NIL_HOLE)
+        atlas->hole_links[link->prev].next = link->next;
+    else
+        atlas->hole_buckets[cw][ch] = link->next;
+
+    if (link->next != ATLAS_NIL_HOLE)
+        atlas->hole_links[link->next].prev = link->prev;
+    atlas->hole_bucket_sizes[cw][ch]--;
+}
+
+/**
+ * Private, appends a new hole, reserving more space if necessary.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg hole: Rect describing the free area, must have a non-zero area.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_push_hole(Atlas *atlas, const Rect *hole)
+{
+    // If we don't have enough hole slots, reserve more.
+    if (atlas->hole_count == atlas->hole_reserved) {
+        uint32_t reserved = atlas_grow_capacity(atlas->hole_reserved);
+        if (!reserved || !atlas_reserve_holes(atlas, reserved))
+            return 0;
+    }
+
+    AtlasIndex index = atlas->hole_count++;
+    atlas_store_hole(atlas, index, hole);
+    atlas_link_hole(atlas, index);
+    return 1;
+}
+
+/**
+ * Private, removes a hole by moving the last hole into its index.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg index: Index of the hole to be removed.
+ **/
+static void atlas_remove_hole(Atlas *atlas, AtlasIndex index)
+{
+    AtlasIndex last = atlas->hole_count - 1;
+
+    atlas_unlink_hole(atlas, index);
+    if (index != last) {
+        atlas_unlink_hole(atlas, last);
+        atlas->hole_left[index] = atlas->hole_left[last];
+        atlas->hole_up[index] = atlas->hole_up[last];
+        atlas->hole_right[index] = atlas->hole_right[last];
+        atlas->hole_down[index] = atlas->hole_down[last];
+        atlas_link_hole(atlas, index);
+    }
+
+    atlas->hole_count--;
+}
+
+/**
+ * Private, reserves room to retire arrays until the atlas gets destroyed.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg count: Number of arrays about to be retired.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_reserve_retired(Atlas *atlas, int count)
+{
+    if (atlas->retired_count + count <= atlas->retired_reserved)
+        return 1;
+
+    int reserved = atlas->retired_reserved ? atlas->retired_reserved * 2 : 16;
+    while (reserved < atlas->retired_count + count)
+        reserved *= 2;
+    RetiredArray *retired = (RetiredArray*)atlas_mem_realloc(&atlas->allocator, atlas->retired,
+                                                             sizeof(retired[0]) * atlas->retired_reserved,
+                                                             sizeof(retired[0]) * reserved);
+    if (!retired)
+        return 0;
+
+    atlas->retired = retired;
+    atlas->retired_reserved = reserved;
+    return 1;
+}
+
+/**
+ * Private, reserves more atlas virtual texture array space.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg reserved: Number of virtual textures to be reserved.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_reserve_vtexes(Atlas *atlas, uint32_t reserved)
+{
+    // The free slot stack must have room for every slot, and is swapped in
+    // only once vtexes grew, so both keep vtex_reserved as their size.
+    const AtlasAllocator *allocator = &atlas->allocator;
+    size_t old_size = sizeof(VirtualTexture) * atlas->vtex_reserved;
+    AtlasIndex *free_slots = (AtlasIndex*)atlas_mem_alloc(allocator, sizeof(free_slots[0]) * reserved);
+    if (!free_slots)
+        return 0;
+
+    // Concurrent look-ups might still be reading the old array, so it gets
+    // copied and retired rather than reallocated.
+    VirtualTexture *vtexes = NULL;
+    if (atlas->concurrent) {
+        if (atlas_reserve_retired(atlas, 1))
+            vtexes = (VirtualTexture*)atlas_mem_alloc(allocator, sizeof(vtexes[0]) * reserved);
+        if (vtexes && atlas->vtexes) {
+            memcpy(vtexes, atlas->vtexes, sizeof(vtexes[0]) * atlas->vtex_slot_count);
+            RetiredArray retired = {atlas->vtexes, old_size};
+            atlas->retired[atlas->retired_count++] = retired;
+        }
+    } else {
+        vtexes = (VirtualTexture*)atlas_mem_realloc(allocator, atlas->vtexes, old_size, sizeof(vtexes[0]) * reserved);
+    }
+    if (!vtexes) {
+        atlas_mem_free(allocator, free_slots, sizeof(free_slots[0]) * reserved);
+        return 0;
+    }
+
+    if (atlas->vtex_free_count)
+        memcpy(free_slots, atlas->vtex_free, sizeof(free_slots[0]) * atlas->vtex_free_count);
+    atlas_mem_free(allocator, atlas->vtex_free, sizeof(free_slots[0]) * atlas->vtex_reserved);
+    atlas->vtex_free = free_slots;
+
+    // Slots not handed out yet must hold no id, lock-free look-ups read them.
+    memset(&vtexes[atlas->vtex_slot_count], 0, sizeof(vtexes[0]) * (reserved - atlas->vtex_slot_count));
+    atlas_atomic_store_ptr((void**)&atlas->vtexes, vtexes);
+    atlas_atomic_store((uint32_t*)&atlas->vtex_reserved, reserved);
+    return 1;
+}
+
+/**
+ * Private, resets hole count to 1 and resets first hole.
+ * @arg atlas: Pointer to atlas structure.
+ **/
+static void atlas_reset_holes(Atlas *atlas)
+{
+    for (int cw = 0; cw < ATLAS_SIZE_CLASSES; cw++) {
+        for (int ch = 0; ch < ATLAS_SIZE_CLASSES; ch++) {
+            atlas->hole_buckets[cw][ch] = ATLAS_NIL_HOLE;
+            atlas->hole_bucket_sizes[cw][ch] = 0;
+        }
+    }
+
+    Rect first = {0, 0, atlas->width, atlas->height};
+    atlas_store_hole(atlas, 0, &first);
+    atlas->hole_count = 1;
+    atlas_link_hole(atlas, 0);
+}
+
+/**
+ * Private, checks if a is completely contained within b.
+ * @param a: Pointer to first Rect.
+ * @param b: Pointer to second Rect.
+ * @returns: 1 if overlaps, 0 otherwise.
+ **/
+static int rect_contained(Rect *a, Rect *b)
+{
+    return ((a->left >= b->left) && (a->right <= b->right)) && 
+           ((a->up   >= b->up  ) && (a->down  <= b->down ));
+}
+
+/**
+ * Private, splits all atlas holes overlapped by the rectangle.
+ * @param atlas: Pointer to private Atlas structure.
+ * @param cut: Rectangle to be carved out of the free space.
+ * @return: 1 on success, 0 otherwise. Failure means structure is left in an invalid state.
+ **/
+static int atlas_split_holes(Atlas *atlas, Rect *cut)
+{
+    int pending = 0, touching = 0;
+    HoleQuery touch;
+    hole_query_touch(&touch, cut);
+
+    // Remove every hole overlapped by the cut, collecting its splits, and
+    // gather the surviving holes only touching it.
+    for (int i = 0; (i = atlas_find_hole(atlas, i, &touch)) < atlas->hole_count;) {
+        Rect hole;
+        atlas_load_hole(atlas, i, &hole);
+        if (hole.right == cut->left || hole.left == cut->right ||
+            hole.down == cut->up || hole.up == cut->down) {
+            atlas->touching_holes[touching++] = i++;
+            continue;
+        }
+
+        // New Rect splits to be considered for emplacing
+        Rect new_holes[4] = {
+            /* Up    */ {hole.left, hole.up,   hole.right, cut->up  },
+            /* Down  */ {hole.left, cut->down, hole.right, hole.down},
+            /* Left  */ {hole.left, hole.up,   cut->left,  hole.down},
+            /* Right */ {cut->right, hole.up,  hole.right, hole.down},
+        };
+
+        for (int j = 0; j < 4; j++) {
+            // Skip zero area holes.
+            if (rect_area(&new_holes[j]) == 0)
+                continue;
+
+            // If we don't have enough pending slots, reserve more.
+            if (pending == atlas->pending_reserved) {
+                if (!atlas_reserve_pending_holes(atlas, atlas->pending_reserved * 2))
+                    return 0;
+            }
+
+            rect_copy(&atlas->pending_holes[pending++], &new_holes[j]);
+        }
+
+        // Deallocate current hole, and retry the index the last hole moved into.
+        atlas_remove_hole(atlas, i);
+    }
+
+    // No surviving hole can be contained by a split, as every split lies
+    // within a hole that didn't contain any other. Only splits need pruning:
+    // drop those contained by a surviving hole, by an already emplaced split
+    // or by a split still pending emplacement. Every split has an edge along
+    // the cut, so any hole containing it touches the cut too.
+    for (int j = 0; j < pending; j++) {
+        Rect *split = &atlas->pending_holes[j];
+        int contained = 0;
+        for (int k = 0; k < touching && !contained; k++) {
+            Rect hole;
+            atlas_load_hole(atlas, atlas->touching_holes[k], &hole);
+            contained = rect_contained(split, &hole);
+        }
+        for (int k = j + 1; k < pending && !contained; k++)
+            contained = rect_contained(split, &atlas->pending_holes[k]);
+        if (contained)
+            continue;
+
+        // Emplace the new hole.
+        if (!atlas_push_hole(atlas, split))
+            return 0;
+        atlas->touching_holes[touching++] = atlas->hole_count - 1;
+    }
+
+    return 1;
+}
+
+/**
+ * Private, returns a rectangle to the free space, merging it with every
+ * adjacent or overlapping hole. Merging two rects yields the rects spanning
+ * their shared horizontal range stacked vertically, and their shared vertical
+ * range side by side; merges are repeated on every new hole until no hole
+ * grows any further.
+ * @param atlas: Pointer to private Atlas structure.
+ * @param freed: Rectangle no longer occupied by any virtual texture.
+ * @return: 1 on success, 0 if the merge budget or memory ran out, in which
+ *          case the holes must be rebuilt.
+ **/
+static int atlas_release_holes(Atlas *atlas, Rect *freed)
+{
+    int head = 0, pending = 0, merges = 0;
+
+    rect_copy(&atlas->pending_holes[pending++], freed);
+    while (head < pending) {
+        Rect merged = atlas->pending_holes[head++];
+
+        // Drop every hole made redundant by the merged one, and gather the
+        // ones touching or overlapping it. Merges with a hole already known
+        // are redundant; no hole contains another, so none got dropped then.
+        int touching = 0, redundant = 0;
+        HoleQuery touch;
+        hole_query_touch(&touch, &merged);
+        for (int i = 0; (i = atlas_find_hole(atlas, i, &touch)) < atlas->hole_count;) {
+            Rect hole;
+            atlas_load_hole(atlas, i, &hole);
+            if ((redundant = rect_contained(&merged, &hole)))
+                break;
+
+            if (rect_contained(&hole, &merged))
+                atlas_remove_hole(atlas, i);
+            else
+                atlas->touching_holes[touching++] = i++;
+        }
+        if (redundant)
+            continue;
+
+        if (++merges > ATLAS_MAX_RELEASE_MERGES)
+            return 0;
+
+        // Queue up merges against every touching hole.
+        for (int i = 0; i < touching; i++) {
+            Rect hole, candidates[2];
+            int count = 0;
+            atlas_load_hole(atlas, atlas->touching_holes[i], &hole);
+
+            int left  = hole.left  > merged.left  ? hole.left  : merged.left;
+            int right = hole.right < merged.right ? hole.right : merged.right;
+            int up    = hole.up    > merged.up    ? hole.up    : merged.up;
+            int down  = hole.down  < merged.down  ? hole.down  : merged.down;
+
+            // Shared horizontal range, with touching or overlapping rows.
+            if (left < right) {
+                Rect stacked = {
+                    left,  hole.up   < merged.up   ? hole.up   : merged.up,
+                    right, hole.down > merged.down ? hole.down : merged.down
+                };
+                candidates[count++] = stacked;
+            }
+
+            // Shared vertical range, with touching or overlapping columns.
+            if (up < down) {
+                Rect beside = {
+                    hole.left  < merged.left  ? hole.left  : merged.left,  up,
+                    hole.right > merged.right ? hole.right : merged.right, down
+                };
+                candidates[count++] = beside;
+            }
+
+            for (int j = 0; j < count; j++) {
+                if (rect_contained(&candidates[j], &merged))
+                    continue;
+
+                // Any hole containing a candidate overlaps the merged hole,
+                // so only touching holes need to be checked at this point.
+                int contained = 0;
+                for (int k = 0; k < touching && !contained; k++) {
+                    Rect other;
+                    atlas_load_hole(atlas, atlas->touching_holes[k], &other);
+                    contained = rect_contained(&candidates[j], &other);
+                }
+                if (contained)
+                    continue;
+
+                // If we don't have enough pending slots, reserve more.
+                if (pending == atlas->pending_reserved) {
+                    if (!atlas_reserve_pending_holes(atlas, atlas->pending_reserved * 2))
+                        return 0;
+                }
+
+                rect_copy(&atlas->pending_holes[pending++], &candidates[j]);
+            }
+        }
+
+        if (!atlas_push_hole(atlas, &merged))
+            return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Private, MaxRects backend set-up, reserves the holes arrays.
+ * @arg atlas: Pointer to atlas structure.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_maxrects_init(Atlas *atlas)
+{
+    if (!atlas_reserve_holes(atlas, ATLAS_MIN_RESERVED_HOLES) ||
+        !atlas_reserve_pending_holes(atlas, ATLAS_MIN_RESERVED_HOLES))
+        return 0;
+
+    atlas_reset_holes(atlas);
+    return 1;
+}
+
+/**
+ * Private, MaxRects backend allocation. Picks the hole scoring best under the
+ * atlas heuristic, and splits every hole overlapped by it.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg w: Width, including padding.
+ * @arg h: Height, including padding.
+ * @arg rotate: Whether the rect may be turned to (h, w).
+ * @arg rect: Pointer to retrieve the allocated Rect.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_maxrects_allocate(Atlas *atlas, int w, int h, int rotate, Rect *rect)
+{
+    // Do a best-fit lookup
+    int rotated;
+    AtlasIndex best_fit = atlas_lookup_hole(atlas, w, h, rotate, &rotated);
+    if (best_fit == ATLAS_NIL_HOLE)
+        return 0;
+    if (rotated) {
+        int turned = w;
+        w = h;
+        h = turned;
+    }
+
+    // Split holes as necessary
+    int left = atlas->hole_left[best_fit], up = atlas->hole_up[best_fit];
+    Rect vtex = {
+        /* left, up    */ left,     up,
+        /* right, down */ left + w, up + h
+    };
+
+    if (!atlas_split_holes(atlas, &vtex)) {
+        atlas->invalidated = 1;
+        return 0;
+    }
+
+    rect_copy(rect, &vtex);
+    return 1;
+}
+
+/**
+ * Private, MaxRects and Guillotine backend measure. Buckets are visited in
+ * decreasing order of their maximum possible area, and the search stops once
+ * no remaining bucket can beat the current largest hole.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg hole_count: Pointer to retrieve the number of holes.
+ * @arg largest: Pointer to retrieve the largest hole width and height.
+ **/
+static void atlas_measure_holes(Atlas *atlas, uint32_t *hole_count, uint16_t *largest)
+{
+    uint32_t largest_area = 0;
+    largest[0] = largest[1] = 0;
+
+    for (int sum = (ATLAS_SIZE_CLASSES - 1) * 2; sum >= 0; sum--) {
+        // Every hole in buckets with cw + ch == sum has area < 2^(sum + 2).
+        if (((uint64_t)1 << (sum + 2)) <= largest_area)
+            break;
+
+        int cw_first = sum - (ATLAS_SIZE_CLASSES - 1);
+        for (int cw = cw_first > 0 ? cw_first : 0; cw <= sum && cw < ATLAS_SIZE_CLASSES; cw++) {
+            AtlasIndex i = atlas->hole_buckets[cw][sum - cw];
+            for (; i != ATLAS_NIL_HOLE; i = atlas->hole_links[i].next) {
+                Rect hole;
+                atlas_load_hole(atlas, i, &hole);
+                if (rect_area(&hole) > largest_area) {
+                    largest_area = rect_area(&hole);
+                    largest[0] = rect_width(&hole);
+                    largest[1] = rect_height(&hole);
+                }
+            }
+        }
+    }
+
+    *hole_count = atlas->hole_count;
+}
+
+/**
+ * Private, MaxRects and Guillotine backend growth preparation. Holes reserve
+ * what merging the new space takes as they go.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg width: New page width.
+ * @arg height: New page height.
+ * @return: 1, always.
+ **/
+static int atlas_prepare_grow_holes(Atlas *atlas, int width, int height)
+{
+    (void)atlas;
+    (void)width;
+    (void)height;
+    return 1;
+}
+
+/**
+ * Private, MaxRects and Guillotine backend growth. The space past the right
+ * and bottom borders is released like the space of a texture, merging it
+ * with the holes along the previous borders.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg width: Previous page width.
+ * @arg height: Previous page height.
+ **/
+static void atlas_grow_holes(Atlas *atlas, int width, int height)
+{
+    Rect right = {width, 0, atlas->width, atlas->height};
+    Rect down = {0, height, width, atlas->height};
+    if ((rect_area(&right) && !atlas->backend->release(atlas, &right)) ||
+        (rect_area(&down) && !atlas->backend->release(atlas, &down)))
+        atlas->invalidated = 1;
+}
+
+static const AtlasBackendOps atlas_maxrects_ops = {
+    atlas_maxrects_init,
+    atlas_reset_holes,
+    atlas_maxrects_allocate,
+    atlas_split_holes,
+    atlas_release_holes,
+    atlas_measure_holes,
+    atlas_prepare_grow_holes,
+    atlas_grow_holes,
+    NULL,
+};
+
+/**
+ * Private, Guillotine backend allocation. Picks the free rect scoring best
+ * under the atlas heuristic, places the rect at its top-left corner, and cuts the leftover in
+ * two disjoint rects along the shorter leftover axis.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg w: Width, including padding.
+ * @arg h: Height, including padding.
+ * @arg rotate: Whether the rect may be turned to (h, w).
+ * @arg rect: Pointer to retrieve the allocated Rect.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_guillotine_allocate(Atlas *atlas, int w, int h, int rotate, Rect *rect)
+{
+    int rotated;
+    AtlasIndex best_fit = atlas_lookup_hole(atlas, w, h, rotate, &rotated);
+    if (best_fit == ATLAS_NIL_HOLE)
+        return 0;
+    if (rotated) {
+        int turned = w;
+        w = h;
+        h = turned;
+    }
+
+    Rect hole;
+    atlas_load_hole(atlas, best_fit, &hole);
+    Rect vtex = {hole.left, hole.up, hole.left + w, hole.up + h};
+    Rect right, down;
+
+    if (rect_width(&hole) - w < rect_height(&hole) - h) {
+        // Bottom leftover spans the whole width.
+        Rect r = {vtex.right, hole.up,   hole.right, vtex.down};
+        Rect d = {hole.left,  vtex.down, hole.right, hole.down};
+        right = r; down = d;
+    } else {
+        // Right leftover spans the whole height.
+        Rect r = {vtex.right, hole.up,   hole.right, hole.down};
+        Rect d = {hole.left,  vtex.down, vtex.right, hole.down};
+        right = r; down = d;
+    }
+
+    atlas_remove_hole(atlas, best_fit);
+    if ((rect_area(&right) && !atlas_push_hole(atlas, &right)) ||
+        (rect_area(&down)  && !atlas_push_hole(atlas, &down))) {
+        atlas->invalidated = 1;
+        return 0;
+    }
+
+    rect_copy(rect, &vtex);
+    return 1;
+}
+
+/**
+ * Private, Guillotine backend occupation. Cuts every free rect overlapped by
+ * the rect into up to four disjoint rects: full width above and below it, and
+ * to its left and right in between.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg cut: Rect to be marked as used.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_guillotine_occupy(Atlas *atlas, Rect *cut)
+{
+    HoleQuery overlap;
+    if (!hole_query_overlap(&overlap, cut))
+        return 1;
+
+    for (int i = 0; (i = atlas_find_hole(atlas, i, &overlap)) < atlas->hole_count;) {
+        Rect hole;
+        atlas_load_hole(atlas, i, &hole);
+
+        int up   = hole.up   > cut->up   ? hole.up   : cut->up;
+        int down = hole.down < cut->down ? hole.down : cut->down;
+        Rect pieces[4] = {
+            /* Up    */ {hole.left,  hole.up,   hole.right, cut->up  },
+            /* Down  */ {hole.left,  cut->down, hole.right, hole.down},
+            /* Left  */ {hole.left,  up,        cut->left,  down     },
+            /* Right */ {cut->right, up,        hole.right, down     },
+        };
+
+        // Deallocate current hole, and retry the index the last hole moved
+        // into. Pieces never overlap the cut, so rescanning them is harmless.
+        atlas_remove_hole(atlas, i);
+        for (int j = 0; j < 4; j++) {
+            if (rect_area(&pieces[j]) && !atlas_push_hole(atlas, &pieces[j]))
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Private, Guillotine backend release. Free rects are kept disjoint, so the
+ * freed rect is added as-is, then repeatedly merged with any free rect sharing
+ * a whole edge with it.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg freed: Rectangle no longer occupied by any virtual texture.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_guillotine_release(Atlas *atlas, Rect *freed)
+{
+    Rect merged = *freed;
+    HoleQuery touch;
+    hole_query_touch(&touch, &merged);
+
+    // Holes sharing an edge with the merged rect touch it.
+    for (int i = 0; (i = atlas_find_hole(atlas, i, &touch)) < atlas->hole_count; i++) {
+        Rect hole;
+        atlas_load_hole(atlas, i, &hole);
+        int columns = hole.left == merged.left && hole.right == merged.right;
+        int rows    = hole.up   == merged.up   && hole.down  == merged.down;
+
+        if (columns && (hole.down == merged.up || hole.up == merged.down)) {
+            if (hole.up < merged.up)
+                merged.up = hole.up;
+            else
+                merged.down = hole.down;
+        } else if (rows && (hole.right == merged.left || hole.left == merged.right)) {
+            if (hole.left < merged.left)
+                merged.left = hole.left;
+            else
+                merged.right = hole.right;
+        } else {
+            continue;
+        }
+
+        // Merged rect grew, rescan every hole against it.
+        atlas_remove_hole(atlas, i);
+        hole_query_touch(&touch, &merged);
+        i = -1;
+    }
+
+    return atlas_push_hole(atlas, &merged);
+}
+
+/**
+ * Private, Guillotine backend arena adoption. The arena's free rects are
+ * disjoint and lie within the arena, so each one is released into the page
+ * like freed space, merging with the page's free rects and each other.
+ * @arg atlas: Pointer to atlas page structure.
+ * @arg space: Private backend of the arena, in arena coordinates.
+ * @arg region: Space the arena takes in the page.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_guillotine_adopt(Atlas *atlas, Atlas *space, const Rect *region)
+{
+    for (int i = 0; i < space->hole_count; i++) {
+        Rect hole;
+        atlas_load_hole(space, i, &hole);
+        hole.left += region->left;
+        hole.up += region->up;
+        hole.right += region->left;
+        hole.down += region->up;
+        if (!atlas_guillotine_release(atlas, &hole))
+            return 0;
+    }
+
+    return 1;
+}
+
+static const AtlasBackendOps atlas_guillotine_ops = {
+    atlas_maxrects_init,
+    atlas_reset_holes,
+    atlas_guillotine_allocate,
+    atlas_guillotine_occupy,
+    atlas_guillotine_release,
+    atlas_measure_holes,
+    atlas_prepare_grow_holes,
+    atlas_grow_holes,
+    atlas_guillotine_adopt,
+};
+
+/**
+ * Private, reserves more skyline segments.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg reserved: Number of segments to be reserved.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_reserve_skyline(Atlas *atlas, int reserved)
+{
+    SkylineNode *skyline = (SkylineNode*)atlas_mem_realloc(&atlas->allocator, atlas->skyline,
+                                                           sizeof(skyline[0]) * atlas->skyline_reserved,
+                                                           sizeof(skyline[0]) * reserved);
+    if (!skyline)
+        return 0;
+
+    atlas->skyline = skyline;
+    atlas->skyline_reserved = reserved;
+    return 1;
+}
+
+/**
+ * Private, resets the skyline to a single segment at the top of the page.
+ * @arg atlas: Pointer to atlas structure.
+ **/
+static void atlas_skyline_reset(Atlas *atlas)
+{
+    SkylineNode first = {0, 0, atlas->width};
+    atlas->skyline[0] = first;
+    atlas->skyline_count = 1;
+}
+
+/**
+ * Private, Skyline backend set-up, reserves the segments array.
+ * @arg atlas: Pointer to atlas structure.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_skyline_init(Atlas *atlas)
+{
+    if (!atlas_reserve_skyline(atlas, ATLAS_MIN_RESERVED_HOLES))
+        return 0;
+
+    atlas_skyline_reset(atlas);
+    return 1;
+}
+
+/**
+ * Private, ensures a skyline segment starts at the given x coordinate.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg x: Coordinate where a segment must start.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_skyline_split(Atlas *atlas, int x)
+{
+    for (int i = 0; i < atlas->skyline_count; i++) {
+        SkylineNode *node = &atlas->skyline[i];
+        if (node->x + node->width <= x)
+            continue;
+        if (node->x == x)
+            return 1;
+
+        // If we don't have enough segments, reserve more.
+        if (atlas->skyline_count == atlas->skyline_reserved) {
+            if (!atlas_reserve_skyline(atlas, atlas->skyline_reserved * 2))
+                return 0;
+            node = &atlas->skyline[i];
+        }
+
+        memmove(&atlas->skyline[i + 2], &atlas->skyline[i + 1],
+                sizeof(atlas->skyline[0]) * (atlas->skyline_count - i - 1));
+        atlas->skyline_count++;
+
+        SkylineNode *next = &atlas->skyline[i + 1];
+        next->x = x;
+        next->y = node->y;
+        next->width = node->x + node->width - x;
+        node->width = x - node->x;
+        return 1;
+    }
+
+    // Past the page end, nothing to split.
+    return 1;
+}
+
+/**
+ * Private, raises every skyline segment within [left, right) to at least the
+ * given height, merging neighbouring segments of equal height.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg rect: Rect to be placed under the skyline.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_skyline_occupy(Atlas *atlas, Rect *rect)
+{
+    if (!atlas_skyline_split(atlas, rect->left) ||
+        !atlas_skyline_split(atlas, rect->right))
+        return 0;
+
+    int count = 0;
+    for (int i = 0; i < atlas->skyline_count; i++) {
+        SkylineNode node = atlas->skyline[i];
+        if (node.x >= rect->left && node.x < rect->right && node.y < rect->down)
+            node.y = rect->down;
+
+        // Merge with the previous segment when heights match.
+        if (count && atlas->skyline[count - 1].y == node.y)
+            atlas->skyline[count - 1].width += node.width;
+        else
+            atlas->skyline[count++] = node;
+    }
+
+    atlas->skyline_count = count;
+    return 1;
+}
+
+/**
+ * Private, computes the lowest height a rect can rest on when its left edge
+ * is placed at the start of a given segment.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg index: Index of the segment.
+ * @arg w: Width, including padding.
+ * @arg h: Height, including padding.
+ * @return: Resting height, or -1 if the rect doesn't fit.
+ **/
+static int atlas_skyline_fit(Atlas *atlas, int index, int w, int h)
+{
+    int x = atlas->skyline[index].x;
+    if (x + w > atlas->width)
+        return -1;
+
+    int y = 0;
+    for (int i = index; x < atlas->skyline[index].x + w; i++) {
+        SkylineNode *node = &atlas->skyline[i];
+        if (node->y > y)
+            y = node->y;
+        if (y + h > atlas->height)
+            return -1;
+        x = node->x + node->width;
+    }
+
+    return y;
+}
+
+/**
+ * Private, Skyline backend allocation. Places the rect at the bottom-left most
+ * position, preferring the lowest resulting top edge, then the tighter segment.
+ * A turned rect is only placed when it does strictly better.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg w: Width, including padding.
+ * @arg h: Height, including padding.
+ * @arg rotate: Whether the rect may be turned to (h, w).
+ * @arg rect: Pointer to retrieve the allocated Rect.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_skyline_allocate(Atlas *atlas, int w, int h, int rotate, Rect *rect)
+{
+    int best = -1, best_top = INT_MAX, best_width = INT_MAX, best_turned = 0;
+    for (int turned = 0; turned <= (rotate && w != h); turned++) {
+        int tw = turned ? h : w, th = turned ? w : h;
+        for (int i = 0; i < atlas->skyline_count; i++) {
+            int y = atlas_skyline_fit(atlas, i, tw, th);
+            if (y < 0)
+                continue;
+
+            int width = atlas->skyline[i].width;
+            if (y + th < best_top || (y + th == best_top && width < best_width)) {
+                best = i;
+                best_top = y + th;
+                best_width = width;
+                best_turned = turned;
+            }
+        }
+    }
+
+    if (best == -1)
+        return 0;
+    if (best_turned) {
+        int turned = w;
+        w = h;
+        h = turned;
+    }
+
+    Rect vtex = {
+        /* left, up    */ atlas->skyline[best].x,     best_top - h,
+        /* right, down */ atlas->skyline[best].x + w, best_top
+    };
+
+    if (!atlas_skyline_occupy(atlas, &vtex)) {
+        atlas->invalidated = 1;
+        return 0;
+    }
+
+    rect_copy(rect, &vtex);
+    return 1;
+}
+
+/**
+ * Private, Skyline backend release. Space below the skyline is unreachable, so
+ * only rects lying right under a segment may lower it, which takes a rebuild.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg freed: Rectangle no longer occupied by any virtual texture.
+ * @return: 1 when nothing changes, 0 if the skyline must be rebuilt.
+ **/
+static int atlas_skyline_release(Atlas *atlas, Rect *freed)
+{
+    for (int i = 0; i < atlas->skyline_count; i++) {
+        SkylineNode *node = &atlas->skyline[i];
+        if (node->x + node->width <= freed->left || node->x >= freed->right)
+            continue;
+        if (node->y == freed->down)
+            return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Private, Skyline backend measure. Every segment below the page bottom is a
+ * hole, and the largest rect spans the widest run of segments at least as
+ * low as the one it rests on.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg hole_count: Pointer to retrieve the number of holes.
+ * @arg largest: Pointer to retrieve the largest rect width and height.
+ **/
+static void atlas_skyline_measure(Atlas *atlas, uint32_t *hole_count, uint16_t *largest)
+{
+    uint32_t largest_area = 0;
+    largest[0] = largest[1] = 0;
+    *hole_count = 0;
+
+    for (int i = 0; i < atlas->skyline_count; i++) {
+        int y = atlas->skyline[i].y;
+        if (y >= atlas->height)
+            continue;
+        (*hole_count)++;
+
+        int first = i, last = i;
+        while (first > 0 && atlas->skyline[first - 1].y <= y)
+            first--;
+        while (last + 1 < atlas->skyline_count && atlas->skyline[last + 1].y <= y)
+            last++;
+
+        int width = atlas->skyline[last].x + atlas->skyline[last].width - atlas->skyline[first].x;
+        uint32_t area = (uint32_t)width * (atlas->height - y);
+        if (area > largest_area) {
+            largest_area = area;
+            largest[0] = width;
+            largest[1] = atlas->height - y;
+        }
+    }
+}
+
+/**
+ * Private, Skyline backend growth preparation, reserves the segment a wider
+ * page may take.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg width: New page width.
+ * @arg height: New page height.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_skyline_prepare_grow(Atlas *atlas, int width, int height)
+{
+    (void)height;
+
+    if (width > atlas->width && atlas->skyline_count == atlas->skyline_reserved)
+        return atlas_reserve_skyline(atlas, atlas->skyline_reserved * 2);
+    return 1;
+}
+
+/**
+ * Private, Skyline backend growth. Space below the skyline reaches down to
+ * the page bottom already, a wider page only adds a segment at the top.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg width: Previous page width.
+ * @arg height: Previous page height.
+ **/
+static void atlas_skyline_grow(Atlas *atlas, int width, int height)
+{
+    (void)height;
+
+    if (atlas->width == width)
+        return;
+
+    SkylineNode *last = &atlas->skyline[atlas->skyline_count - 1];
+    if (last->y == 0) {
+        last->width += atlas->width - width;
+    } else {
+        SkylineNode node = {width, 0, atlas->width - width};
+        atlas->skyline[atlas->skyline_count++] = node;
+    }
+}
+
+static const AtlasBackendOps atlas_skyline_ops = {
+    atlas_skyline_init,
+    atlas_skyline_reset,
+    atlas_skyline_allocate,
+    atlas_skyline_occupy,
+    atlas_skyline_release,
+    atlas_skyline_measure,
+    atlas_skyline_prepare_grow,
+    atlas_skyline_grow,
+    NULL,
+};
+
+/**
+ * Private, reserves more shelves.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg reserved: Number of shelves to be reserved.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_reserve_shelves(Atlas *atlas, int reserved)
+{
+    Shelf *shelves = (Shelf*)atlas_mem_realloc(&atlas->allocator, atlas->shelves,
+                                               sizeof(shelves[0]) * atlas->shelf_reserved,
+                                               sizeof(shelves[0]) * reserved);
+    if (!shelves)
+        return 0;
+
+    atlas->shelves = shelves;
+    atlas->shelf_reserved = reserved;
+    return 1;
+}
+
+/**
+ * Private, computes the height class of a texture or shelf height.
+ * @arg height: Height, including padding.
+ * @return: Height class, height rounded up to the shelf granularity.
+ **/
+static inline int shelf_class(int height)
+{
+    return (height + ATLAS_SHELF_GRANULARITY - 1) / ATLAS_SHELF_GRANULARITY;
+}
+
+/**
+ * Private, reserves the per class lists and the row map, covering as many
+ * rows as the classes do. The arrays are swapped in together, so they keep
+ * sharing shelf_classes as their size should any allocation fail.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg classes: Number of height classes to be reserved.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_reserve_shelf_classes(Atlas *atlas, int classes)
+{
+    const AtlasAllocator *allocator = &atlas->allocator;
+    int rows = classes * ATLAS_SHELF_GRANULARITY, reserved = atlas->shelf_classes;
+    uint16_t *open = (uint16_t*)atlas_mem_alloc(allocator, sizeof(open[0]) * classes);
+    uint16_t *empty = (uint16_t*)atlas_mem_alloc(allocator, sizeof(empty[0]) * classes);
+    uint16_t *row_map = (uint16_t*)atlas_mem_alloc(allocator, sizeof(row_map[0]) * rows);
+    if (!open || !empty || !row_map) {
+        atlas_mem_free(allocator, open, sizeof(open[0]) * classes);
+        atlas_mem_free(allocator, empty, sizeof(empty[0]) * classes);
+        atlas_mem_free(allocator, row_map, sizeof(row_map[0]) * rows);
+        return 0;
+    }
+
+    for (int i = 0; i < classes; i++)
+        open[i] = empty[i] = ATLAS_NIL_SHELF;
+    for (int i = 0; i < rows; i++)
+        row_map[i] = ATLAS_NIL_SHELF;
+    if (reserved) {
+        memcpy(open, atlas->shelf_open, sizeof(open[0]) * reserved);
+        memcpy(empty, atlas->shelf_empty, sizeof(empty[0]) * reserved);
+        memcpy(row_map, atlas->shelf_rows, sizeof(row_map[0]) * reserved * ATLAS_SHELF_GRANULARITY);
+    }
+    atlas_mem_free(allocator, atlas->shelf_open, sizeof(open[0]) * reserved);
+    atlas_mem_free(allocator, atlas->shelf_empty, sizeof(empty[0]) * reserved);
+    atlas_mem_free(allocator, atlas->shelf_rows, sizeof(row_map[0]) * reserved * ATLAS_SHELF_GRANULARITY);
+
+    atlas->shelf_open = open;
+    atlas->shelf_empty = empty;
+    atlas->shelf_rows = row_map;
+    atlas->shelf_classes = classes;
+    return 1;
+}
+
+/**
+ * Private, drops every shelf, leaving the whole page unused.
+ * @arg atlas: Pointer to atlas structure.
+ **/
+static void atlas_shelf_reset(Atlas *atlas)
+{
+    for (int i = 0; i < atlas->shelf_classes; i++)
+        atlas->shelf_open[i] = atlas->shelf_empty[i] = ATLAS_NIL_SHELF;
+    for (int i = 0; i <= atlas->height; i++)
+        atlas->shelf_rows[i] = ATLAS_NIL_SHELF;
+
+    atlas->shelf_count = 0;
+    atlas->shelf_bottom = 0;
+}
+
+/**
+ * Private, Shelf backend set-up, reserves shelves and per class lists.
+ * @arg atlas: Pointer to atlas structure.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_shelf_init(Atlas *atlas)
+{
+    if (!atlas_reserve_shelf_classes(atlas, shelf_class(atlas->height) + 1) ||
+        !atlas_reserve_shelves(atlas, ATLAS_MIN_RESERVED_HOLES))
+        return 0;
+
+    atlas_shelf_reset(atlas);
+    return 1;
+}
+
+/**
+ * Private, makes a shelf the open shelf of a height class.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg cls: Height class.
+ * @arg index: Index of the shelf.
+ **/
+static void atlas_shelf_set_open(Atlas *atlas, int cls, uint16_t index)
+{
+    uint16_t previous = atlas->shelf_open[cls];
+    if (previous != ATLAS_NIL_SHELF)
+        atlas->shelves[previous].open = ATLAS_NIL_SHELF;
+
+    atlas->shelves[index].open = cls;
+    atlas->shelf_open[cls] = index;
+}
+
+/**
+ * Private, opens a new shelf for a height class. Emptied shelves of the same
+ * height come first, then never used space, then any taller emptied shelf.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg cls: Height class of the shelf.
+ * @return: Index of the shelf, ATLAS_NIL_SHELF if out of space.
+ **/
+static uint16_t atlas_shelf_open(Atlas *atlas, int cls)
+{
+    int height = cls * ATLAS_SHELF_GRANULARITY;
+    if (height > atlas->height)
+        height = atlas->height;
+
+    uint16_t index = atlas->shelf_empty[cls];
+    if (index == ATLAS_NIL_SHELF && atlas->shelf_bottom + height <= atlas->height) {
+        // If we don't have enough shelves reserved, reserve more.
+        if (atlas->shelf_count == atlas->shelf_reserved) {
+            if (!atlas_reserve_shelves(atlas, atlas->shelf_reserved * 2))
+                return ATLAS_NIL_SHELF;
+        }
+
+        index = atlas->shelf_count++;
+        Shelf *shelf = &atlas->shelves[index];
+        shelf->y = atlas->shelf_bottom;
+        shelf->height = height;
+        shelf->cursor = 0;
+        shelf->live = 0;
+        shelf->open = ATLAS_NIL_SHELF;
+        shelf->stacked = 0;
+        for (int y = shelf->y; y < shelf->y + height; y++)
+            atlas->shelf_rows[y] = index;
+        atlas->shelf_bottom += height;
+        return index;
+    }
+
+    // Fall back to the shortest emptied shelf taller than needed.
+    for (int taller = cls; index == ATLAS_NIL_SHELF && taller < atlas->shelf_classes; taller++) {
+        cls = taller;
+        index = atlas->shelf_empty[taller];
+    }
+
+    if (index != ATLAS_NIL_SHELF)
+        atlas->shelf_empty[cls] = atlas->shelves[index].next;
+    return index;
+}
+
+/**
+ * Private, Shelf backend allocation. Textures go at the end of the open shelf
+ * of their height class, a new shelf is opened once it runs out of room.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg w: Width, including padding.
+ * @arg h: Height, including padding.
+ * @arg rotate: Ignored, textures are placed upright.
+ * @arg rect: Pointer to retrieve the allocated Rect.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_shelf_allocate(Atlas *atlas, int w, int h, int rotate, Rect *rect)
+{
+    (void)rotate;
+
+    if (w <= 0 || h <= 0 || w > atlas->width || h > atlas->height)
+        return 0;
+
+    int cls = shelf_class(h);
+    uint16_t index = atlas->shelf_open[cls];
+    if (index == ATLAS_NIL_SHELF || atlas->shelves[index].cursor + w > atlas->width) {
+        if ((index = atlas_shelf_open(atlas, cls)) == ATLAS_NIL_SHELF)
+            return 0;
+        atlas_shelf_set_open(atlas, cls, index);
+    }
+
+    Shelf *shelf = &atlas->shelves[index];
+    Rect vtex = {shelf->cursor, shelf->y, shelf->cursor + w, shelf->y + h};
+    shelf->cursor += w;
+    shelf->live++;
+
+    rect_copy(rect, &vtex);
+    return 1;
+}
+
+/**
+ * Private, grows a shelf to reach down to a given coordinate, rounded up to
+ * the shelf granularity.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg shelf: Pointer to the shelf.
+ * @arg down: Bottom coordinate the shelf must reach.
+ **/
+static void atlas_shelf_grow(Atlas *atlas, Shelf *shelf, int down)
+{
+    int height = shelf_class(down - shelf->y) * ATLAS_SHELF_GRANULARITY;
+    if (height > atlas->height - shelf->y)
+        height = atlas->height - shelf->y;
+    if (height > shelf->height)
+        shelf->height = height;
+}
+
+/**
+ * Private, Shelf backend occupation, used to rebuild shelves from scratch and
+ * to take back the textures of retired arenas. Rects starting within a shelf
+ * end up in it, grown to fit them. Textures packed elsewhere, e.g. in a
+ * retired arena, don't line up with the rows, so rows grown over other ones
+ * absorb them.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg rect: Rect to be marked as used.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_shelf_occupy(Atlas *atlas, Rect *rect)
+{
+    uint16_t index = atlas->shelf_rows[rect->up];
+    if (index == ATLAS_NIL_SHELF) {
+        // If we don't have enough shelves reserved, reserve more.
+        if (atlas->shelf_count == atlas->shelf_reserved) {
+            if (!atlas_reserve_shelves(atlas, atlas->shelf_reserved * 2))
+                return 0;
+        }
+
+        index = atlas->shelf_count++;
+        Shelf *shelf = &atlas->shelves[index];
+        shelf->y = rect->up;
+        shelf->height = shelf->cursor = shelf->live = shelf->stacked = 0;
+        shelf->open = ATLAS_NIL_SHELF;
+    } else if (!atlas->shelves[index].live && atlas->shelves[index].open == ATLAS_NIL_SHELF) {
+        // Outside of rebuilds, an emptied shelf may wait for reuse, take it
+        // off that list.
+        uint16_t *link = &atlas->shelf_empty[shelf_class(atlas->shelves[index].height)];
+        while (*link != ATLAS_NIL_SHELF && *link != index)
+            link = &atlas->shelves[*link].next;
+        if (*link == index)
+            *link = atlas->shelves[index].next;
+    }
+
+    Shelf *shelf = &atlas->shelves[index];
+    int bottom = shelf->y + shelf->height;
+    atlas_shelf_grow(atlas, shelf, rect->down);
+    if (rect->right > shelf->cursor)
+        shelf->cursor = rect->right;
+    shelf->stacked |= rect->up != shelf->y;
+    shelf->live++;
+
+    // Map the rows the shelf grew over, absorbing the shelves found there.
+    // Absorbed shelves are left empty, without any height, until the next
+    // rebuild, so shelf indices stay put.
+    for (int y = bottom; y < shelf->y + shelf->height; y++) {
+        uint16_t other_index = atlas->shelf_rows[y];
+        if (other_index != ATLAS_NIL_SHELF && other_index != index) {
+            Shelf *other = &atlas->shelves[other_index];
+            atlas_shelf_grow(atlas, shelf, other->y + other->height);
+            if (other->cursor > shelf->cursor)
+                shelf->cursor = other->cursor;
+            shelf->live += other->live;
+            shelf->stacked = 1;
+            for (int row = other->y; row < other->y + other->height; row++)
+                atlas->shelf_rows[row] = index;
+
+            if (other->open != ATLAS_NIL_SHELF)
+                atlas->shelf_open[other->open] = ATLAS_NIL_SHELF;
+            other->height = other->cursor = other->live = other->stacked = 0;
+            other->open = ATLAS_NIL_SHELF;
+        }
+        atlas->shelf_rows[y] = index;
+    }
+
+    if (shelf->y + shelf->height > atlas->shelf_bottom)
+        atlas->shelf_bottom = shelf->y + shelf->height;
+
+    // Rows open up for the height they were rebuilt with.
+    int cls = shelf_class(shelf->height);
+    if (shelf->open != ATLAS_NIL_SHELF && shelf->open != cls)
+        atlas->shelf_open[shelf->open] = ATLAS_NIL_SHELF;
+    atlas_shelf_set_open(atlas, cls, index);
+    return 1;
+}
+
+/**
+ * Private, Shelf backend release. Space at the end of a row is given back
+ * right away, and a row is recycled once its last texture is released.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg freed: Rectangle no longer occupied by any virtual texture.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_shelf_release(Atlas *atlas, Rect *freed)
+{
+    uint16_t index = atlas->shelf_rows[freed->up];
+    Shelf *shelf = &atlas->shelves[index];
+
+    if (freed->right == shelf->cursor && !shelf->stacked)
+        shelf->cursor = freed->left;
+    if (--shelf->live)
+        return 1;
+
+    // Emptied shelves stay open if they were, otherwise become reusable.
+    shelf->cursor = 0;
+    shelf->stacked = 0;
+    if (shelf->open != ATLAS_NIL_SHELF)
+        return 1;
+
+    int cls = shelf_class(shelf->height);
+    shelf->next = atlas->shelf_empty[cls];
+    atlas->shelf_empty[cls] = index;
+    return 1;
+}
+
+/**
+ * Private, Shelf backend measure. Holes are the space left at the end of each
+ * row, and the never used space below the last one.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg hole_count: Pointer to retrieve the number of holes.
+ * @arg largest: Pointer to retrieve the largest hole width and height.
+ **/
+static void atlas_shelf_measure(Atlas *atlas, uint32_t *hole_count, uint16_t *largest)
+{
+    uint32_t largest_area = (uint32_t)atlas->width * (atlas->height - atlas->shelf_bottom);
+    largest[0] = largest_area ? atlas->width : 0;
+    largest[1] = largest_area ? atlas->height - atlas->shelf_bottom : 0;
+    *hole_count = largest_area ? 1 : 0;
+
+    for (int i = 0; i < atlas->shelf_count; i++) {
+        Shelf *shelf = &atlas->shelves[i];
+        uint32_t area = (uint32_t)(atlas->width - shelf->cursor) * shelf->height;
+        if (!area)
+            continue;
+        (*hole_count)++;
+
+        if (area > largest_area) {
+            largest_area = area;
+            largest[0] = atlas->width - shelf->cursor;
+            largest[1] = shelf->height;
+        }
+    }
+}
+
+/**
+ * Private, Shelf backend growth preparation, reserves the classes and rows of
+ * a taller page.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg width: New page width.
+ * @arg height: New page height.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_shelf_prepare_grow(Atlas *atlas, int width, int height)
+{
+    (void)width;
+
+    int classes = shelf_class(height) + 1;
+    return classes <= atlas->shelf_classes || atlas_reserve_shelf_classes(atlas, classes);
+}
+
+/**
+ * Private, Shelf backend growth. Rows get longer on their own, and the never
+ * used space reaches further down. The row ending at the previous bottom may
+ * have been cut short by it, so it gets its full class height back first.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg width: Previous page width.
+ * @arg height: Previous page height.
+ **/
+static void atlas_shelf_grow_page(Atlas *atlas, int width, int height)
+{
+    (void)width;
+
+    for (int i = 0; i < atlas->shelf_count && atlas->height > height; i++) {
+        Shelf *shelf = &atlas->shelves[i];
+        if (!shelf->height || shelf->y + shelf->height != height)
+            continue;
+
+        atlas_shelf_grow(atlas, shelf, height);
+        for (int y = height; y < shelf->y + shelf->height; y++)
+            atlas->shelf_rows[y] = i;
+        if (shelf->y + shelf->height > atlas->shelf_bottom)
+            atlas->shelf_bottom = shelf->y + shelf->height;
+    }
+}
+
+static const AtlasBackendOps atlas_shelf_ops = {
+    atlas_shelf_init,
+    atlas_shelf_reset,
+    atlas_shelf_allocate,
+    atlas_shelf_occupy,
+    atlas_shelf_release,
+    atlas_shelf_measure,
+    atlas_shelf_prepare_grow,
+    atlas_shelf_grow_page,
+    NULL,
+};
+
+/**
+ * Private, computes the level of the smallest block a length fits into.
+ * @arg length: Width or height of a rectangle.
+ * @returns: ceil(log2(length)).
+ **/
+static inline int block_level(int length)
+{
+    int level = 0;
+    while ((1 << level) < length)
+        level++;
+    return level;
+}
+
+/**
+ * Private, reserves more quadtree nodes.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg reserved: Number of nodes to be reserved.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_reserve_quad_nodes(Atlas *atlas, uint32_t reserved)
+{
+    QuadNode *nodes = (QuadNode*)atlas_mem_realloc(&atlas->allocator, atlas->quad_nodes,
+                                                   sizeof(nodes[0]) * atlas->quad_reserved,
+                                                   sizeof(nodes[0]) * reserved);
+    if (!nodes)
+        return 0;
+
+    atlas->quad_nodes = nodes;
+    atlas->quad_reserved = reserved;
+    return 1;
+}
+
+/**
+ * Private, splits a leaf into four leaves sharing its state.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg index: Index of the leaf node.
+ * @arg level: Level of the leaf node.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_quad_split(Atlas *atlas, uint32_t index, int level)
+{
+    uint32_t children = atlas->quad_free;
+    if (children) {
+        atlas->quad_free = atlas->quad_nodes[children].children;
+    } else {
+        // If we don't have enough nodes reserved, reserve more.
+        if (atlas->quad_count + 4 > atlas->quad_reserved) {
+            if (!atlas_reserve_quad_nodes(atlas, atlas->quad_reserved * 2))
+                return 0;
+        }
+
+        children = atlas->quad_count;
+        atlas->quad_count += 4;
+    }
+
+    int8_t largest = atlas->quad_nodes[index].largest < 0 ? -1 : level - 1;
+    if (largest >= 0)
+        atlas->quad_holes += 3;
+    for (int i = 0; i < 4; i++) {
+        atlas->quad_nodes[children + i].children = 0;
+        atlas->quad_nodes[children + i].largest = largest;
+    }
+
+    atlas->quad_nodes[index].children = children;
+    return 1;
+}
+
+/**
+ * Private, returns every node below a node to the unused groups.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg index: Index of the node, left as a leaf.
+ **/
+static void atlas_quad_prune(Atlas *atlas, uint32_t index)
+{
+    uint32_t children = atlas->quad_nodes[index].children;
+    if (!children)
+        return;
+
+    for (int i = 0; i < 4; i++) {
+        if (atlas->quad_nodes[children + i].children)
+            atlas_quad_prune(atlas, children + i);
+        else if (atlas->quad_nodes[children + i].largest >= 0)
+            atlas->quad_holes--;
+    }
+
+    atlas->quad_nodes[children].children = atlas->quad_free;
+    atlas->quad_free = children;
+    atlas->quad_nodes[index].children = 0;
+}
+
+/**
+ * Private, marks the region [left, right) x [up, down) as used or unused,
+ * splitting blocks partially covered by it and merging blocks back once all
+ * four children share the same state. Block aligned regions only touch one
+ * path down the tree.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg index: Index of the node.
+ * @arg x: Left coordinate of the node block.
+ * @arg y: Top coordinate of the node block.
+ * @arg level: Level of the node.
+ * @arg region: Region bounds, as left, up, right and down.
+ * @arg used: 1 to mark the region as used, 0 to mark it as free.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_quad_mark(Atlas *atlas, uint32_t index, int x, int y, int level,
+                           const int *region, int used)
+{
+    int size = 1 << level;
+    if (region[0] >= x + size || region[2] <= x || region[1] >= y + size || region[3] <= y)
+        return 1;
+
+    QuadNode *node = &atlas->quad_nodes[index];
+    int8_t state = used ? -1 : level;
+
+    // Blocks fully within the region become leaves.
+    if (region[0] <= x && region[2] >= x + size && region[1] <= y && region[3] >= y + size) {
+        if (!node->children && node->largest >= 0)
+            atlas->quad_holes--;
+        atlas_quad_prune(atlas, index);
+        atlas->quad_nodes[index].largest = state;
+        if (state >= 0)
+            atlas->quad_holes++;
+        return 1;
+    }
+
+    // Leaves already in the requested state are left untouched.
+    if (!node->children && node->largest == state)
+        return 1;
+    if (!node->children && !atlas_quad_split(atlas, index, level))
+        return 0;
+
+    int half = size >> 1;
+    uint32_t children = atlas->quad_nodes[index].children;
+    for (int i = 0; i < 4; i++) {
+        if (!atlas_quad_mark(atlas, children + i, x + (i & 1) * half, y + (i >> 1) * half,
+                             level - 1, region, used))
+            return 0;
+    }
+
+    // Merge children back when they are all leaves in the same state.
+    int8_t largest = -1;
+    int mergeable = 1;
+    for (int i = 0; i < 4; i++) {
+        QuadNode *child = &atlas->quad_nodes[children + i];
+        if (child->largest > largest)
+            largest = child->largest;
+        mergeable &= !child->children && child->largest == atlas->quad_nodes[children].largest;
+    }
+
+    if (mergeable) {
+        atlas_quad_prune(atlas, index);
+        largest = atlas->quad_nodes[children].largest < 0 ? -1 : level;
+        if (largest >= 0)
+            atlas->quad_holes++;
+    }
+
+    atlas->quad_nodes[index].largest = largest;
+    return 1;
+}
+
+/**
+ * Private, marks a region of the page as used or unused.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg left, up, right, down: Region bounds.
+ * @arg used: 1 to mark the region as used, 0 to mark it as free.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_quad_mark_region(Atlas *atlas, int left, int up, int right, int down, int used)
+{
+    int region[4] = {left, up, right, down};
+    return atlas_quad_mark(atlas, 0, 0, 0, atlas->quad_levels, region, used);
+}
+
+/**
+ * Private, frees the whole tree, and marks anything past the page as used.
+ * @arg atlas: Pointer to atlas structure.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_buddy_clear(Atlas *atlas)
+{
+    int size = 1 << atlas->quad_levels;
+
+    atlas->quad_count = 1;
+    atlas->quad_free = 0;
+    atlas->quad_holes = 1;
+    atlas->quad_nodes[0].children = 0;
+    atlas->quad_nodes[0].largest = atlas->quad_levels;
+    atlas->wasted_area = 0;
+
+    return atlas_quad_mark_region(atlas, atlas->width, 0, size, size, 1) &&
+           atlas_quad_mark_region(atlas, 0, atlas->height, atlas->width, size, 1);
+}
+
+/**
+ * Private, Buddy backend set-up.
+ * @arg atlas: Pointer to atlas structure.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_buddy_init(Atlas *atlas)
+{
+    atlas->quad_levels = block_level(atlas->width > atlas->height ? atlas->width : atlas->height);
+    if (!atlas_reserve_quad_nodes(atlas, ATLAS_MIN_RESERVED_HOLES))
+        return 0;
+
+    return atlas_buddy_clear(atlas);
+}
+
+/**
+ * Private, Buddy backend reset. The margins were already carved once by
+ * atlas_buddy_init and nodes are never given back, so this can't fail.
+ * @arg atlas: Pointer to atlas structure.
+ **/
+static void atlas_buddy_reset(Atlas *atlas)
+{
+    atlas_buddy_clear(atlas);
+}
+
+/**
+ * Private, Buddy backend allocation. Rounds the rect up to a power-of-two
+ * square block, and descends the tree towards the child with the smallest
+ * free block that still fits.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg w: Width, including padding.
+ * @arg h: Height, including padding.
+ * @arg rotate: Ignored, blocks are square.
+ * @arg rect: Pointer to retrieve the allocated Rect.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_buddy_allocate(Atlas *atlas, int w, int h, int rotate, Rect *rect)
+{
+    (void)rotate;
+
+    if (w <= 0 || h <= 0)
+        return 0;
+
+    int target = block_level(w > h ? w : h);
+    if (atlas->quad_nodes[0].largest < target)
+        return 0;
+
+    uint32_t index = 0;
+    int x = 0, y = 0;
+    for (int level = atlas->quad_levels; level > target; level--) {
+        // Free leaves are split by atlas_quad_mark, keeping to their top-left.
+        uint32_t children = atlas->quad_nodes[index].children;
+        if (!children)
+            break;
+
+        int best = -1;
+        for (int i = 0; i < 4; i++) {
+            int8_t largest = atlas->quad_nodes[children + i].largest;
+            if (largest >= target && (best == -1 || largest < atlas->quad_nodes[children + best].largest))
+                best = i;
+        }
+
+        index = children + best;
+        x += (best & 1) << (level - 1);
+        y += (best >> 1) << (level - 1);
+    }
+
+    int size = 1 << target;
+    if (!atlas_quad_mark_region(atlas, x, y, x + size, y + size, 1)) {
+        atlas->invalidated = 1;
+        return 0;
+    }
+
+    Rect vtex = {x, y, x + w, y + h};
+    atlas->wasted_area += (uint64_t)size * size - (uint64_t)w * h;
+    rect_copy(rect, &vtex);
+    return 1;
+}
+
+/**
+ * Private, computes the block a Buddy backend rect was allocated from.
+ * Rects not aligned to their block are taken as they are.
+ * @arg rect: Allocated Rect.
+ * @arg block: Block bounds, as left, up, right and down.
+ **/
+static void atlas_buddy_block(Rect *rect, int *block)
+{
+    int size = 1 << block_level(rect_width(rect) > rect_height(rect) ? rect_width(rect) : rect_height(rect));
+
+    block[0] = rect->left;
+    block[1] = rect->up;
+    block[2] = rect->right;
+    block[3] = rect->down;
+    if (rect->left % size == 0 && rect->up % size == 0) {
+        block[2] = rect->left + size;
+        block[3] = rect->up + size;
+    }
+}
+
+/**
+ * Private, Buddy backend occupation, marks the block of a rect as used.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg rect: Rect to be marked as used.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_buddy_occupy(Atlas *atlas, Rect *rect)
+{
+    int block[4];
+    atlas_buddy_block(rect, block);
+    if (!atlas_quad_mark_region(atlas, block[0], block[1], block[2], block[3], 1))
+        return 0;
+
+    atlas->wasted_area += (uint64_t)(block[2] - block[0]) * (block[3] - block[1]) - rect_area(rect);
+    return 1;
+}
+
+/**
+ * Private, Buddy backend release, frees the block of a rect and merges it
+ * back with its buddies.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg freed: Rectangle no longer occupied by any virtual texture.
+ * @return: 1 on success, 0 if the tree must be rebuilt.
+ **/
+static int atlas_buddy_release(Atlas *atlas, Rect *freed)
+{
+    int block[4];
+    atlas_buddy_block(freed, block);
+    if (!atlas_quad_mark_region(atlas, block[0], block[1], block[2], block[3], 0))
+        return 0;
+
+    atlas->wasted_area -= (uint64_t)(block[2] - block[0]) * (block[3] - block[1]) - rect_area(freed);
+    return 1;
+}
+
+/**
+ * Private, Buddy backend measure. Holes are the free leaves, and the largest
+ * one is the block the root keeps track of.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg hole_count: Pointer to retrieve the number of holes.
+ * @arg largest: Pointer to retrieve the largest block width and height.
+ **/
+static void atlas_buddy_measure(Atlas *atlas, uint32_t *hole_count, uint16_t *largest)
+{
+    int8_t level = atlas->quad_nodes[0].largest;
+    largest[0] = largest[1] = level < 0 ? 0 : 1 << level;
+    *hole_count = atlas->quad_holes;
+}
+
+/**
+ * Private, Buddy backend growth preparation. Pages outgrowing the root block
+ * get a new root per level, with the previous tree as its top-left child and
+ * the other children used until the new space gets freed.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg width: New page width.
+ * @arg height: New page height.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_buddy_prepare_grow(Atlas *atlas, int width, int height)
+{
+    int levels = block_level(width > height ? width : height);
+    while (atlas->quad_levels < levels) {
+        QuadNode root = atlas->quad_nodes[0];
+        atlas->quad_nodes[0].children = 0;
+        atlas->quad_nodes[0].largest = -1;
+        if (!atlas_quad_split(atlas, 0, atlas->quad_levels + 1)) {
+            atlas->quad_nodes[0] = root;
+            return 0;
+        }
+
+        atlas->quad_nodes[atlas->quad_nodes[0].children] = root;
+        atlas->quad_nodes[0].largest = root.largest;
+        atlas->quad_levels++;
+    }
+
+    return 1;
+}
+
+/**
+ * Private, Buddy backend growth, frees the space past the previous borders.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg width: Previous page width.
+ * @arg height: Previous page height.
+ **/
+static void atlas_buddy_grow(Atlas *atlas, int width, int height)
+{
+    if ((atlas->width > width && !atlas_quad_mark_region(atlas, width, 0, atlas->width, atlas->height, 0)) ||
+        (atlas->height > height && !atlas_quad_mark_region(atlas, 0, height, width, atlas->height, 0)))
+        atlas->invalidated = 1;
+}
+
+static const AtlasBackendOps atlas_buddy_ops = {
+    atlas_buddy_init,
+    atlas_buddy_reset,
+    atlas_buddy_allocate,
+    atlas_buddy_occupy,
+    atlas_buddy_release,
+    atlas_buddy_measure,
+    atlas_buddy_prepare_grow,
+    atlas_buddy_grow,
+    NULL,
+};
+
+/**
+ * Private, packing backends indexed by AtlasBackend.
+ **/
+static const AtlasBackendOps *atlas_backends[] = {
+    &atlas_maxrects_ops,
+    &atlas_skyline_ops,
+    &atlas_guillotine_ops,
+    &atlas_shelf_ops,
+    &atlas_buddy_ops,
+};
+
+/**
+ * Private, looks up the live arena of a page containing a rect.
+ * @arg atlas: Pointer to atlas page structure.
+ * @arg rect: Pointer to the rect.
+ * @returns: Index of the arena, otherwise -1.
+ **/
+static int atlas_lookup_arena(Atlas *atlas, Rect *rect)
+{
+    for (int i = 0; i < atlas->arena_count; i++) {
+        if (rect_contained(rect, &atlas->arenas[i]))
+            return i;
+    }
+
+    return -1;
+}
+
+/**
+ * Private, regenerates the backend of a page from scratch by marking the
+ * space of every virtual texture allocated in it as used.
+ * @param atlas: Pointer to private Atlas page structure.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_rebuild(Atlas *atlas)
+{
+    Atlas *owner = atlas->owner;
+    atlas->backend->reset(atlas);
+    for (int i = 0; i < owner->vtex_slot_count; i++) {
+        VirtualTexture *vt = &owner->vtexes[i];
+
+        // Ignore textures that haven't had space allocated for them, and
+        // the ones covered by their arena.
+        if (rect_area(&vt->rect) == 0 || vt->page != atlas->page ||
+            atlas_lookup_arena(atlas, &vt->rect) != -1)
+            continue;
+
+        if (!atlas->backend->occupy(atlas, &vt->rect))
+            return 0;
+    }
+
+    for (int i = 0; i < atlas->arena_count; i++) {
+        if (!atlas->backend->occupy(atlas, &atlas->arenas[i]))
+            return 0;
+    }
+
+    atlas->invalidated = 0;
+    return 1;
+}
+
+/**
+ * Private, initializes the locks of a concurrent atlas page.
+ * @arg atlas: Pointer to atlas structure.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_init_locks(Atlas *atlas)
+{
+    if (!atlas_mutex_init(&atlas->lock))
+        return 0;
+    if (!atlas_mutex_init(&atlas->meta_lock)) {
+        atlas_mutex_destroy(&atlas->lock);
+        return 0;
+    }
+
+    atlas->concurrent = 1;
+    return 1;
+}
+
+/**
+ * Private, appends a page to its owner's page lists, last in allocation order.
+ * Page lists are reserved for max_pages up front, so concurrent allocations
+ * can walk them while pages get added.
+ * @arg owner: Pointer to the owning atlas structure.
+ * @arg page: Pointer to the atlas page structure, with its backend set up.
+ **/
+static void atlas_add_page(Atlas *owner, Atlas *page)
+{
+    page->owner = owner;
+    page->page = page->page_rank = owner->page_count;
+    owner->pages[page->page] = page;
+    owner->ranked_pages[page->page_rank] = page;
+    owner->page_count++;
+}
+
+/**
+ * Private, opens a new empty page sharing its owner's settings.
+ * @arg owner: Pointer to the owning atlas structure.
+ * @arg locked: Whether to return the page locked, for callers holding the
+ *              meta lock.
+ * @returns: Pointer to the new page if successful, otherwise NULL.
+ **/
+static Atlas *atlas_open_page(Atlas *owner, int locked)
+{
+    if (owner->page_count >= owner->max_pages)
+        return NULL;
+
+    Atlas *page = (Atlas*)atlas_mem_calloc(&owner->allocator, sizeof(*page));
+    if (!page)
+        return NULL;
+
+    page->allocator = owner->allocator;
+    page->backend = owner->backend;
+    page->width = owner->width;
+    page->height = owner->height;
+    page->padding = owner->padding;
+    page->heuristic = owner->heuristic;
+    if (owner->concurrent && !atlas_init_locks(page)) {
+        atlas_mem_free(&owner->allocator, page, sizeof(*page));
+        return NULL;
+    }
+    if (!page->backend->init(page)) {
+        atlas_destroy(page);
+        return NULL;
+    }
+
+    // Lock the page before adding it makes it reachable. Nobody else can
+    // hold it yet, so this never waits, even under the meta lock.
+    if (locked && page->concurrent)
+        atlas_mutex_trylock(&page->lock);
+    atlas_add_page(owner, page);
+    return page;
+}
+
+/**
+ * Private, moves a page whose used area changed to its place in allocation
+ * order. Pages only move when filling the fullest pages first.
+ * @arg owner: Pointer to the owning atlas structure.
+ * @arg page: Pointer to the atlas page structure.
+ **/
+static void atlas_rank_page(Atlas *owner, Atlas *page)
+{
+    if (owner->page_order != ATLAS_PAGES_FULLEST_FIRST)
+        return;
+
+    Atlas **ranked = owner->ranked_pages;
+    int rank = page->page_rank;
+    while (rank > 0 && ranked[rank - 1]->used_area < page->used_area) {
+        ranked[rank] = ranked[rank - 1];
+        ranked[rank]->page_rank = rank;
+        rank--;
+    }
+    while (rank + 1 < owner->page_count && ranked[rank + 1]->used_area > page->used_area) {
+        ranked[rank] = ranked[rank + 1];
+        ranked[rank]->page_rank = rank;
+        rank++;
+    }
+
+    ranked[rank] = page;
+    page->page_rank = rank;
+}
+
+/**
+ * Private, stores a value in little-endian order.
+ * @arg bytes: Pointer to the destination bytes.
+ * @arg value: Value to be stored.
+ * @arg size: Number of bytes to store.
+ * @returns: Pointer past the stored bytes.
+ **/
+static uint8_t *store_le(uint8_t *bytes, uint32_t value, int size)
+{
+    for (int i = 0; i < size; i++)
+        *bytes++ = (uint8_t)(value >> (i * 8));
+    return bytes;
+}
+
+/**
+ * Private, loads a value stored in little-endian order.
+ * @arg bytes: Pointer to the source bytes.
+ * @arg value: Pointer to retrieve the value.
+ * @arg size: Number of bytes to load.
+ * @returns: Pointer past the loaded bytes.
+ **/
+static const uint8_t *load_le(const uint8_t *bytes, uint32_t *value, int size)
+{
+    *value = 0;
+    for (int i = 0; i < size; i++)
+        *value |= (uint32_t)*bytes++ << (i * 8);
+    return bytes;
+}
+
+/**
+ * Private, records a call to the atlas trace, if tracing. Must hold the meta
+ * lock, so records of concurrent calls never interleave.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg op: Call being recorded.
+ * @arg id: Unique virtual texture identifier, page growth has none.
+ * @arg w: Requested width, allocations and page growth only.
+ * @arg h: Requested height, allocations and page growth only.
+ * @arg flags: Allocation flags, ATLAS_TRACE_ALLOCATE_EX only.
+ * @arg result: Call result, allocations and page growth only.
+ **/
+static void atlas_trace_record(Atlas *atlas, AtlasTraceOp op, uint32_t id, uint16_t w, uint16_t h,
+                               uint32_t flags, int result)
+{
+    if (!atlas->trace_write)
+        return;
+
+    uint8_t record[11], *end = record;
+    end = store_le(end, op, 1);
+    if (op == ATLAS_TRACE_GROW) {
+        end = store_le(end, w, 2);
+        end = store_le(end, h, 2);
+        end = store_le(end, result != 0, 1);
+    } else {
+        end = store_le(end, id, 4);
+    }
+    if (op == ATLAS_TRACE_ALLOCATE || op == ATLAS_TRACE_ALLOCATE_EX) {
+        end = store_le(end, w, 2);
+        end = store_le(end, h, 2);
+        if (op == ATLAS_TRACE_ALLOCATE_EX)
+            end = store_le(end, flags, 1);
+        end = store_le(end, result != 0, 1);
+    }
+
+    atlas->trace_write(record, end - record, atlas->trace_user);
+}
+
+/**
+ * Creates and populate atlas structure.
+ * @arg atlas_ptr: Double pointer to atlas structure, undefined on failure.
+ * @arg options: Atlas page dimensions, padding, packing backend, heuristic,
+ *               pages, concurrency and memory. Concurrent atlases can be used
+ *               from several threads at once: coordinate and page queries
+ *               never lock, allocations lock a single page and spread over
+ *               pages. Metadata is allocated through the given allocator, or
+ *               within the given buffer, in which case allocations fail once
+ *               the buffer is full and the atlas must be destroyed before the
+ *               buffer gets reused.
+ * @return: 1 on success, 0 otherwise.
+ **/
+int atlas_create_ex(Atlas **atlas_dptr, const AtlasOptions *options)
+{
+    if ((unsigned)options->backend >= sizeof(atlas_backends) / sizeof(atlas_backends[0]) ||
+        (unsigned)options->heuristic > ATLAS_HEURISTIC_CONTACT_POINT ||
+        (unsigned)options->page_order > ATLAS_PAGES_FULLEST_FIRST ||
+        (options->allocator && (!options->allocator->alloc || !options->allocator->free)))
+        return 0;
+
+    // Carve a heap out of the caller buffer, every page and arena then
+    // allocates from it.
+    AtlasHeap *heap = NULL;
+    AtlasAllocator allocator = options->allocator ? *options->allocator : atlas_default_allocator;
+    if (options->buffer) {
+        if (!(heap = atlas_heap_init(options->buffer, options->buffer_size, options->concurrent)))
+            goto err_allocate;
+        AtlasAllocator heap_allocator = {atlas_heap_alloc, atlas_heap_realloc, atlas_heap_free, heap};
+        allocator = heap_allocator;
+    }
+
+    Atlas *atlas = (Atlas*)atlas_mem_calloc(&allocator, sizeof(*atlas));
+    if (!atlas)
+        goto err_heap;
+
+    atlas->allocator = allocator;
+    atlas->heap = heap;
+
+    atlas->backend = atlas_backends[options->backend];
+    atlas->width = options->dimensions;
+    atlas->height = options->height ? options->height : options->dimensions;
+    atlas->padding = options->padding;
+    atlas->heuristic = options->heuristic;
+    atlas->max_pages = options->max_pages ? options->max_pages : 1;
+    atlas->page_order = options->page_order;
+
+    // Pages of concurrent atlases are filled independently, ranking them
+    // would need every page locked on each allocation.
+    if (options->concurrent) {
+        if (!atlas_init_locks(atlas))
+            goto err_reserve;
+        atlas->page_order = ATLAS_PAGES_FIRST_FIT;
+    }
+
+    // Attempt to reserve space for the necessary meta-data structures, and
+    // initialize the backend with the whole first page free.
+    atlas->pages = (Atlas**)atlas_mem_calloc(&allocator, sizeof(atlas->pages[0]) * atlas->max_pages);
+    atlas->ranked_pages = (Atlas**)atlas_mem_calloc(&allocator, sizeof(atlas->ranked_pages[0]) * atlas->max_pages);
+    if (!atlas->pages || !atlas->ranked_pages ||
+        !atlas_reserve_vtexes(atlas, ATLAS_MIN_RESERVED_VTEXES) ||
+        !atlas->backend->init(atlas))
+        goto err_reserve;
+
+    atlas_add_page(atlas, atlas);
+
+    *atlas_dptr = atlas;
+    return 1;
+err_reserve:
+    atlas_destroy(atlas);
+    return 0;
+err_heap:
+    if (heap && heap->concurrent)
+        atlas_mutex_destroy(&heap->lock);
+err_allocate:
+    return 0;
+}
+
+/**
+ * Creates and populate atlas structure, using the MaxRects backend.
+ * @arg atlas_ptr: Double pointer to atlas structure, undefined on failure.
+ * @arg dimensions: Defines atlas width and height dimenions, see
+ *                  AtlasOptions::height for non-square pages.
+ * @arg padding: Defines padding added to all sides of a virtual texture.
+ * @return: 1 on success, 0 otherwise.
+ **/
+int atlas_create(Atlas **atlas_dptr, uint16_t dimensions, uint16_t padding)
+{
+    AtlasOptions options;
+    memset(&options, 0, sizeof(options));
+    options.dimensions = dimensions;
+    options.padding = padding;
+    options.backend = ATLAS_BACKEND_MAXRECTS;
+    options.heuristic = ATLAS_HEURISTIC_BEST_AREA;
+    options.max_pages = 1;
+    options.page_order = ATLAS_PAGES_FIRST_FIT;
+    return atlas_create_ex(atlas_dptr, &options);
+}
+
+/**
+ * Starts recording texture generation, allocation and destruction calls, as a
+ * binary trace to be replayed offline. The trace starts with the atlas
+ * options, so it should be started before any texture is generated. Page
+ * growth is recorded too, arena, defragmentation and compaction calls are not.
+ * @arg atlas: Pointer to private Atlas structure.
+ * @arg write: Callback receiving the trace bytes in order, NULL to stop.
+ * @arg user: Pointer handed over to the callback.
+ * @return: 1 on success, 0 otherwise.
+ **/
+int atlas_trace(Atlas *atlas, AtlasTraceWrite write, void *user)
+{
+    uint8_t header[18], *end = header;
+    memcpy(end, ATLAS_TRACE_MAGIC, 4);
+    end = store_le(end + 4, ATLAS_TRACE_VERSION, 1);
+
+    int backend = 0;
+    while (atlas_backends[backend] != atlas->backend)
+        backend++;
+
+    // Pages grow under the meta lock, so the options are read under it too.
+    atlas_lock_meta(atlas);
+    end = store_le(end, ATLAS_TRACE_CREATE, 1);
+    end = store_le(end, atlas->width, 2);
+    end = store_le(end, atlas->padding, 2);
+    end = store_le(end, backend, 1);
+    end = store_le(end, atlas->heuristic, 1);
+    end = store_le(end, atlas->max_pages, 2);
+    end = store_le(end, atlas->page_order, 1);
+    end = store_le(end, atlas->concurrent, 1);
+    end = store_le(end, atlas->height, 2);
+
+    atlas->trace_write = write;
+    atlas->trace_user = user;
+    if (write)
+        write(header, end - header, user);
+    atlas_unlock_meta(atlas);
+    return 1;
+}
+
+/**
+ * Free atlas and all data allocated by the atlas.
+ * @arg atlas: Pointer to private Atlas structure.
+ */
+void atlas_destroy(Atlas *atlas)
+{
+    // Pages past the first are only referenced by their owner.
+    for (int i = 1; i < atlas->page_count; i++)
+        atlas_destroy(atlas->pages[i]);
+
+    // Allocators get back the size of every array, sizes follow the
+    // reserved counts.
+    const AtlasAllocator *allocator = &atlas->allocator;
+    atlas_mem_free(allocator, atlas->pages, sizeof(atlas->pages[0]) * atlas->max_pages);
+    atlas_mem_free(allocator, atlas->ranked_pages, sizeof(atlas->ranked_pages[0]) * atlas->max_pages);
+    atlas_mem_free(allocator, atlas->hole_left, sizeof(atlas->hole_left[0]) * 4 * atlas->hole_reserved);
+    atlas_mem_free(allocator, atlas->hole_links, sizeof(atlas->hole_links[0]) * atlas->hole_reserved);
+    atlas_mem_free(allocator, atlas->touching_holes, sizeof(atlas->touching_holes[0]) * atlas->hole_reserved);
+    atlas_mem_free(allocator, atlas->pending_holes, sizeof(atlas->pending_holes[0]) * atlas->pending_reserved);
+    atlas_mem_free(allocator, atlas->skyline, sizeof(atlas->skyline[0]) * atlas->skyline_reserved);
+    atlas_mem_free(allocator, atlas->shelves, sizeof(atlas->shelves[0]) * atlas->shelf_reserved);
+    atlas_mem_free(allocator, atlas->shelf_open, sizeof(uint16_t) * atlas->shelf_classes);
+    atlas_mem_free(allocator, atlas->shelf_empty, sizeof(uint16_t) * atlas->shelf_classes);
+    atlas_mem_free(allocator, atlas->shelf_rows, sizeof(uint16_t) * atlas->shelf_classes * ATLAS_SHELF_GRANULARITY);
+    atlas_mem_free(allocator, atlas->quad_nodes, sizeof(atlas->quad_nodes[0]) * atlas->quad_reserved);
+    atlas_mem_free(allocator, atlas->vtexes, sizeof(atlas->vtexes[0]) * atlas->vtex_reserved);
+    atlas_mem_free(allocator, atlas->vtex_free, sizeof(atlas->vtex_free[0]) * atlas->vtex_reserved);
+    for (int i = 0; i < atlas->retired_count; i++)
+        atlas_mem_free(allocator, atlas->retired[i].ptr, atlas->retired[i].size);
+    atlas_mem_free(allocator, atlas->retired, sizeof(atlas->retired[0]) * atlas->retired_reserved);
+    atlas_mem_free(allocator, atlas->arenas, sizeof(atlas->arenas[0]) * atlas->arena_reserved);
+    if (atlas->concurrent) {
+        atlas_mutex_destroy(&atlas->lock);
+        atlas_mutex_destroy(&atlas->meta_lock);
+    }
+
+    // The heap lives in the caller buffer, it goes once nothing is left in it.
+    AtlasAllocator owner_allocator = atlas->allocator;
+    AtlasHeap *heap = atlas->heap;
+    atlas_mem_free(&owner_allocator, atlas, sizeof(*atlas));
+    if (heap && heap->concurrent)
+        atlas_mutex_destroy(&heap->lock);
+}
+
+/**
+ * Acquires a virtual texture slot.
+ * @arg atlas: Pointer to private Atlas structure.
+ * @arg id_ptr: Pointer to retrieve virtual texture slot id.
+ * @return: 1 on success, 0 otherwise.
+ **/
+int atlas_gen_texture(Atlas *atlas, uint32_t *id_ptr)
+{
+    atlas_lock_meta(atlas);
+    atlas_write_begin(atlas);
+
+    // Reuse the last freed slot if any. Otherwise take a new one, doubling
+    // the number of reserved slots if we don't have enough.
+    int slot;
+    if (atlas->vtex_free_count) {
+        slot = atlas->vtex_free[--atlas->vtex_free_count];
+    } else {
+        if (atlas->vtex_slot_count >= atlas->vtex_reserved) {
+            uint32_t reserved = atlas_grow_capacity(atlas->vtex_reserved);
+            if (reserved > ATLAS_MAX_VTEXES)
+                reserved = ATLAS_MAX_VTEXES;
+            if (reserved <= (uint32_t)atlas->vtex_reserved || !atlas_reserve_vtexes(atlas, reserved)) {
+                atlas_write_end(atlas);
+                atlas_unlock_meta(atlas);
+                return 0;
+            }
+        }
+        slot = atlas->vtex_slot_count++;
+        atlas->vtexes[slot].generation = 1;
+    }
+
+    VirtualTexture *vt = &atlas->vtexes[slot];
+    vt->id = ((uint32_t)vt->generation << ATLAS_SLOT_BITS) | slot;
+    vt->rect.left = vt->rect.up = vt->rect.right = vt->rect.down = 0;
+    vt->page = 0;
+    vt->rotated = 0;
+    atlas->vtex_count++;
+
+    *id_ptr = vt->id;
+    atlas_write_end(atlas);
+    atlas_trace_record(atlas, ATLAS_TRACE_GEN, vt->id, 0, 0, 0, 1);
+    atlas_unlock_meta(atlas);
+    return 1;
+}
+
+/**
+ * Private, looks up a virtual texture and locks both the page it lies in and
+ * the virtual textures. Page locks come first, so concurrent atlases peek at
+ * the page without locking and look again once both locks are held.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg id: Unique virtual texture identifier.
+ * @arg index_ptr: Pointer to retrieve the virtual texture slot.
+ * @returns: Pointer to the locked page, or NULL if the id isn't valid.
+ **/
+static Atlas *atlas_lock_vtex_page(Atlas *atlas, uint32_t id, int *index_ptr)
+{
+    if (!atlas->concurrent) {
+        if ((*index_ptr = atlas_lookup_vtex_id(atlas, id)) == -1)
+            return NULL;
+        return atlas->pages[atlas->vtexes[*index_ptr].page];
+    }
+
+    VirtualTexture vt;
+    while (atlas_read_vtex(atlas, id, &vt, NULL)) {
+        Atlas *page = atlas->pages[vt.page];
+        atlas_lock(page);
+        atlas_lock_meta(atlas);
+        if ((*index_ptr = atlas_lookup_vtex_id(atlas, id)) != -1 &&
+            atlas->vtexes[*index_ptr].page == vt.page)
+            return page;
+
+        // Texture destroyed or moved to another page meanwhile.
+        atlas_unlock_meta(atlas);
+        atlas_unlock(page);
+    }
+
+    return NULL;
+}
+
+/**
+ * Releases a virtual texture and returns its space to the atlas. Should the
+ * space not be merged back cheaply, holes get rebuilt the next time a texture
+ * gets uploaded.
+ * @arg atlas: Pointer to private Atlas structure.
+ * @arg id: Unique virtual texture identifier.
+ * @return: 1 on success, 0 otherwise.
+ **/
+int atlas_destroy_vtex(Atlas *atlas, uint32_t id)
+{
+    int index;
+    Atlas *page;
+    if (!(page = atlas_lock_vtex_page(atlas, id, &index)))
+        return 0;
+
+    VirtualTexture *vt = &atlas->vtexes[index];
+    Rect freed = vt->rect;
+    atlas->padding_area -= rect_padding_area(&freed, atlas->padding);
+
+    // Free the slot under a new generation, so the id and any copy of it
+    // stop matching, and keep it for the next generated texture.
+    atlas_write_begin(atlas);
+    vt->id = ATLAS_INVALID_VTEX_ID;
+    vt->generation = vt->generation >= ATLAS_MAX_GENERATION ? 1 : vt->generation + 1;
+    vt->rect.left = vt->rect.up = vt->rect.right = vt->rect.down = 0;
+    vt->page = 0;
+    vt->rotated = 0;
+    atlas->vtex_free[atlas->vtex_free_count++] = index;
+    atlas->vtex_count--;
+    atlas->compact_idle = 0;
+    atlas_write_end(atlas);
+    atlas_trace_record(atlas, ATLAS_TRACE_DESTROY, id, 0, 0, 0, 1);
+    atlas_unlock_meta(atlas);
+
+    // Textures that never had space allocated have nothing to give back,
+    // and the ones in a live arena give it back once the arena is retired.
+    // Emptied pages start over, releases alone don't always merge all the
+    // space back, e.g. Guillotine cuts that never line up again.
+    if (rect_area(&freed) != 0 && atlas_lookup_arena(page, &freed) == -1) {
+        page->used_area -= rect_area(&freed);
+        atlas_rank_page(atlas, page);
+        if (page->used_area == 0) {
+            page->backend->reset(page);
+            page->invalidated = 0;
+        } else if (!page->invalidated && !page->backend->release(page, &freed)) {
+            page->invalidated = 1;
+        }
+    }
+
+    atlas_unlock(page);
+    return 1;
+}
+
+/**
+ * Private, stores the space allocated for a virtual texture. Must hold the
+ * meta lock.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg id: Unique virtual texture identifier.
+ * @arg page: Pointer to the atlas page the space lies in.
+ * @arg rect: Space allocated, padding included.
+ * @arg rotated: Whether the texture lies turned in that space.
+ * @return: 1 on success, 0 if the id isn't valid anymore or another thread
+ *          gave it space meanwhile.
+ **/
+static int atlas_commit_vtex(Atlas *atlas, uint32_t id, Atlas *page, Rect *rect, int rotated)
+{
+    int index;
+    if ((index = atlas_lookup_vtex_id(atlas, id)) == -1 || rect_area(&atlas->vtexes[index].rect) != 0)
+        return 0;
+
+    atlas->padding_area += rect_padding_area(rect, atlas->padding);
+
+    atlas_write_begin(atlas);
+    rect_copy(&atlas->vtexes[index].rect, rect);
+    atlas->vtexes[index].page = page->page;
+    atlas->vtexes[index].rotated = rotated != 0;
+    atlas_write_end(atlas);
+    return 1;
+}
+
+/**
+ * Private, rebuilds the backend of a locked page if releasing space failed.
+ * @arg page: Pointer to the atlas page structure.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_validate_page(Atlas *page)
+{
+    if (!page->invalidated)
+        return 1;
+
+    atlas_lock_meta(page->owner);
+    int rebuilt = atlas_rebuild(page);
+    atlas_unlock_meta(page->owner);
+    return rebuilt;
+}
+
+/**
+ * Private, allocates space in a locked page, rebuilding its backend first if
+ * releasing space failed.
+ * @arg page: Pointer to the atlas page structure.
+ * @arg w: Width, padding included.
+ * @arg h: Height, padding included.
+ * @arg rotate: Whether the space may be turned to (h, w).
+ * @arg rect: Pointer to retrieve the allocated space.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_allocate_page(Atlas *page, int w, int h, int rotate, Rect *rect)
+{
+    if (!atlas_validate_page(page))
+        return 0;
+
+    return page->backend->allocate(page, w, h, rotate, rect);
+}
+
+/**
+ * Private, lets the backends of existing pages find room for some space,
+ * spilling over to a new page once every page is full. Concurrent atlases
+ * start every call at the next page and skip pages held by other threads,
+ * only waiting for them once no free page had room. New pages are filled
+ * before other threads get to see them.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg w: Width, padding included.
+ * @arg h: Height, padding included.
+ * @arg rotate: Whether the space may be turned to (h, w).
+ * @arg rect: Pointer to retrieve the allocated space.
+ * @returns: Pointer to the page holding the space, locked, or NULL if no
+ *           page had room.
+ **/
+static Atlas *atlas_reserve_space(Atlas *atlas, int w, int h, int rotate, Rect *rect)
+{
+    if (!atlas->concurrent) {
+        for (int rank = 0; rank < atlas->page_count; rank++) {
+            Atlas *page = atlas->ranked_pages[rank];
+            if (atlas_allocate_page(page, w, h, rotate, rect))
+                return page;
+        }
+    }
+
+    for (;;) {
+        atlas_lock_meta(atlas);
+        int page_count = atlas->page_count;
+        atlas_unlock_meta(atlas);
+
+        uint32_t start = atlas->concurrent ? atlas_atomic_increment(&atlas->page_cursor) : 0;
+        for (int pass = 0; pass < 2 && atlas->concurrent; pass++) {
+            int skipped = 0;
+            for (int i = 0; i < page_count; i++) {
+                Atlas *page = atlas->pages[(start + i) % page_count];
+                if (pass == 0 && !atlas_mutex_trylock(&page->lock)) {
+                    skipped++;
+                    continue;
+                }
+                if (pass == 1)
+                    atlas_mutex_lock(&page->lock);
+
+                if (atlas_allocate_page(page, w, h, rotate, rect))
+                    return page;
+                atlas_mutex_unlock(&page->lock);
+            }
+
+            if (!skipped)
+                break;
+        }
+
+        // Try again if another thread opened a page since we looked. Pages
+        // grow under the meta lock, so the page size is read under it too.
+        atlas_lock_meta(atlas);
+        if (atlas->page_count != page_count) {
+            atlas_unlock_meta(atlas);
+            continue;
+        }
+        if ((w > atlas->width || h > atlas->height) && (!rotate || h > atlas->width || w > atlas->height)) {
+            atlas_unlock_meta(atlas);
+            return NULL;
+        }
+
+        // Don't keep pages around for space that fits no page at all.
+        Atlas *page;
+        if ((page = atlas_open_page(atlas, 1))) {
+            if (!page->backend->allocate(page, w, h, rotate, rect)) {
+                atlas_unlock(page);
+                atlas->page_count--;
+                atlas_destroy(page);
+                page = NULL;
+            }
+        }
+
+        atlas_unlock_meta(atlas);
+        return page;
+    }
+}
+
+/**
+ * Allocates space for the virtual texture. Textures get space only once,
+ * destroy and generate them again to move them elsewhere.
+ * @arg atlas: Pointer to private Atlas structure.
+ * @arg id: Unique virtual texture identifier.
+ * @arg w: Virtual texture width.
+ * @arg h: Virtual texture height.
+ * @return: 1 on success, 0 otherwise.
+ **/
+int atlas_allocate_vtex_space(Atlas *atlas, uint32_t id, uint16_t w, uint16_t h)
+{
+    return atlas_allocate_vtex_space_ex(atlas, id, w, h, 0);
+}
+
+/**
+ * Allocates space for the virtual texture, with AtlasAllocateFlags. With
+ * ATLAS_ALLOCATE_ROTATE, the texture may be stored turned 90 degrees
+ * clockwise when that fits better, see atlas_get_vtex_rotated. Fails for
+ * textures that already have space.
+ * @arg atlas: Pointer to private Atlas structure.
+ * @arg id: Unique virtual texture identifier.
+ * @arg w: Virtual texture width.
+ * @arg h: Virtual texture height.
+ * @arg flags: Combination of AtlasAllocateFlags.
+ * @return: 1 on success, 0 otherwise.
+ **/
+int atlas_allocate_vtex_space_ex(Atlas *atlas, uint32_t id, uint16_t w, uint16_t h, uint32_t flags)
+{
+    // Look-up virtual texture id, if not found or placed already, bail out.
+    // Placing it again would leave its previous space occupied.
+    VirtualTexture vt;
+    if ((flags & ~(uint32_t)ATLAS_ALLOCATE_ROTATE) || !atlas_read_vtex(atlas, id, &vt, NULL) ||
+        rect_area(&vt.rect) != 0)
+        return 0;
+
+    // Add padding, and find a page with room for it.
+    Atlas *page;
+    Rect vtex;
+    int pw = w + atlas->padding * 2, ph = h + atlas->padding * 2;
+    int rotate = (flags & ATLAS_ALLOCATE_ROTATE) != 0;
+    if (!(page = atlas_reserve_space(atlas, pw, ph, rotate, &vtex))) {
+        atlas_lock_meta(atlas);
+        atlas_trace_record(atlas, flags ? ATLAS_TRACE_ALLOCATE_EX : ATLAS_TRACE_ALLOCATE, id, w, h, flags, 0);
+        atlas_unlock_meta(atlas);
+        return 0;
+    }
+
+    // The texture might have been destroyed meanwhile by another thread.
+    atlas_lock_meta(atlas);
+    int committed = atlas_commit_vtex(atlas, id, page, &vtex, pw != ph && rect_width(&vtex) != pw);
+    if (committed)
+        atlas_trace_record(atlas, flags ? ATLAS_TRACE_ALLOCATE_EX : ATLAS_TRACE_ALLOCATE, id, w, h, flags, 1);
+    atlas_unlock_meta(atlas);
+    if (committed) {
+        page->used_area += rect_area(&vtex);
+        atlas_rank_page(atlas, page);
+    } else if (!page->backend->release(page, &vtex)) {
+        page->invalidated = 1;
+    }
+
+    atlas_unlock(page);
+    return committed;
+}
+
+/**
+ * Private, locks every page, in page order, and then the virtual textures.
+ * Starts over if a page got opened meanwhile, so no page is left out.
+ * @arg atlas: Pointer to atlas structure.
+ * @returns: Number of pages locked, the atlas page count.
+ **/
+static int atlas_lock_pages(Atlas *atlas)
+{
+    for (;;) {
+        atlas_lock_meta(atlas);
+        int page_count = atlas->page_count;
+        atlas_unlock_meta(atlas);
+
+        for (int i = 0; i < page_count; i++)
+            atlas_lock(atlas->pages[i]);
+        atlas_lock_meta(atlas);
+        if (page_count == atlas->page_count)
+            return page_count;
+
+        atlas_unlock_meta(atlas);
+        for (int i = 0; i < page_count; i++)
+            atlas_unlock(atlas->pages[i]);
+    }
+}
+
+/**
+ * Private, unlocks what atlas_lock_pages locked.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg page_count: Number of pages locked.
+ **/
+static void atlas_unlock_pages(Atlas *atlas, int page_count)
+{
+    atlas_unlock_meta(atlas);
+    for (int i = 0; i < page_count; i++)
+        atlas_unlock(atlas->pages[i]);
+}
+
+/**
+ * Private, finds room for some space while holding every page and the
+ * virtual textures, spilling over to a new page once every page is full.
+ * New pages stay locked along with the others.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg w: Width, padding included.
+ * @arg h: Height, padding included.
+ * @arg page_count: Pointer to the number of pages locked, counting new ones.
+ * @arg rect: Pointer to retrieve the allocated space.
+ * @returns: Pointer to the page holding the space, or NULL if no page had
+ *           room.
+ **/
+static Atlas *atlas_reserve_locked_space(Atlas *atlas, int w, int h, int *page_count, Rect *rect)
+{
+    // The meta lock is held already, so rebuild invalidated pages directly.
+    for (int rank = 0; rank < atlas->page_count; rank++) {
+        Atlas *page = atlas->ranked_pages[rank];
+        if (page->invalidated && !atlas_rebuild(page))
+            continue;
+        if (page->backend->allocate(page, w, h, 0, rect))
+            return page;
+    }
+
+    if (w > atlas->width || h > atlas->height)
+        return NULL;
+
+    Atlas *page;
+    if ((page = atlas_open_page(atlas, 1))) {
+        (*page_count)++;
+        if (!page->backend->allocate(page, w, h, 0, rect)) {
+            atlas_unlock(page);
+            (*page_count)--;
+            atlas->page_count--;
+            atlas_destroy(page);
+            page = NULL;
+        }
+    }
+
+    return page;
+}
+
+/**
+ * Private, qsort comparator ordering batch entries by decreasing key, and
+ * by increasing item index for equal keys.
+ **/
+static int batch_entry_compare(const void *a, const void *b)
+{
+    const BatchEntry *ea = (const BatchEntry*)a, *eb = (const BatchEntry*)b;
+    if (ea->key != eb->key)
+        return ea->key < eb->key ? 1 : -1;
+    return ea->item < eb->item ? -1 : ea->item > eb->item;
+}
+
+/**
+ * Allocates space for a set of virtual textures at once. Textures are placed
+ * in the given sort order, largest first, which packs much denser and splits
+ * fewer holes than placing them in arrival order. Every page and the virtual
+ * textures are locked once for the whole batch, and textures go straight to
+ * the page backends, without looking for a free page for each of them.
+ * @arg atlas: Pointer to private Atlas structure.
+ * @arg ids: Unique virtual texture identifiers, n of them.
+ * @arg wh: Virtual texture width and height pairs, 2 * n of them.
+ * @arg n: Number of virtual textures.
+ * @arg order: Order in which the textures are placed.
+ * @arg results: Optional, set to 1 for every texture that got space, 0 otherwise.
+ * @return: 1 if every texture got space, 0 otherwise.
+ **/
+int atlas_allocate_batch(Atlas *atlas, const uint32_t *ids, const uint16_t *wh, size_t n,
+                         AtlasSortOrder order, uint8_t *results)
+{
+    if (results)
+        memset(results, 0, n);
+    if (!n)
+        return 1;
+
+    BatchEntry *entries = (BatchEntry*)atlas_mem_alloc(&atlas->allocator, sizeof(entries[0]) * n);
+    if (!entries)
+        return 0;
+
+    for (size_t i = 0; i < n; i++) {
+        uint32_t w = wh[i * 2], h = wh[i * 2 + 1];
+        entries[i].item = i;
+        switch (order) {
+        case ATLAS_SORT_MAX_SIDE:
+            entries[i].key = w > h ? (w << 16) | h : (h << 16) | w;
+            break;
+        case ATLAS_SORT_AREA:
+            entries[i].key = w * h;
+            break;
+        case ATLAS_SORT_PERIMETER:
+            entries[i].key = w + h;
+            break;
+        default:
+            entries[i].key = 0;
+            break;
+        }
+    }
+
+    if (order != ATLAS_SORT_NONE)
+        qsort(entries, n, sizeof(entries[0]), batch_entry_compare);
+
+    // Hold every page for the whole batch, instead of searching for a free
+    // page and locking it again for each texture.
+    int page_count = atlas_lock_pages(atlas);
+
+    int placed = 1;
+    for (size_t i = 0; i < n; i++) {
+        size_t item = entries[i].item;
+        uint32_t id = ids[item];
+        uint16_t w = wh[item * 2], h = wh[item * 2 + 1];
+        int index, success = 0;
+
+        // Textures not found or placed already are skipped, as
+        // atlas_allocate_vtex_space does.
+        if ((index = atlas_lookup_vtex_id(atlas, id)) == -1 || rect_area(&atlas->vtexes[index].rect) != 0) {
+            placed = 0;
+            continue;
+        }
+
+        Atlas *page;
+        Rect vtex;
+        if ((page = atlas_reserve_locked_space(atlas, w + atlas->padding * 2, h + atlas->padding * 2,
+                                               &page_count, &vtex))) {
+            success = atlas_commit_vtex(atlas, id, page, &vtex, 0);
+            page->used_area += rect_area(&vtex);
+            atlas_rank_page(atlas, page);
+        }
+
+        atlas_trace_record(atlas, ATLAS_TRACE_ALLOCATE, id, w, h, 0, success);
+        if (results)
+            results[item] = (uint8_t)success;
+        placed &= success;
+    }
+
+    atlas_unlock_pages(atlas, page_count);
+    atlas_mem_free(&atlas->allocator, entries, sizeof(entries[0]) * n);
+    return placed;
+}
+
+/**
+ * Reserves a square region of a page for a single thread to allocate virtual
+ * textures in. Allocations in an arena don't lock any page, so loader threads
+ * each packing into their own arena don't contend with each other. The whole
+ * region counts as used until the arena gets retired.
+ * @arg atlas: Pointer to private Atlas structure.
+ * @arg dimensions: Arena width and height.
+ * @arg arena_dptr: Double pointer to arena structure, undefined on failure.
+ * @return: 1 on success, 0 otherwise.
+ **/
+int atlas_arena_create(Atlas *atlas, uint16_t dimensions, AtlasArena **arena_dptr)
+{
+    AtlasArena *arena = (AtlasArena*)atlas_mem_calloc(&atlas->allocator, sizeof(*arena));
+    if (!arena)
+        goto err_allocate;
+
+    arena->owner = atlas;
+    arena->space = (Atlas*)atlas_mem_calloc(&atlas->allocator, sizeof(*arena->space));
+    if (!arena->space)
+        goto err_space;
+
+    arena->space->allocator = atlas->allocator;
+    arena->space->backend = atlas->backend;
+    arena->space->width = arena->space->height = dimensions;
+    // The space has no owner to walk textures of, but no backend needs them
+    // outside of rebuilds, heuristics included, which only look at holes.
+    arena->space->heuristic = atlas->heuristic;
+    if (!arena->space->backend->init(arena->space))
+        goto err_space;
+
+    if (!(arena->page = atlas_reserve_space(atlas, dimensions, dimensions, 0, &arena->rect)))
+        goto err_space;
+
+    Atlas *page = arena->page;
+    if (page->arena_count >= page->arena_reserved) {
+        int reserved = page->arena_reserved ? page->arena_reserved * 2 : 4;
+        Rect *arenas = (Rect*)atlas_mem_realloc(&atlas->allocator, page->arenas,
+                                                sizeof(arenas[0]) * page->arena_reserved,
+                                                sizeof(arenas[0]) * reserved);
+        if (!arenas)
+            goto err_reserve;
+        page->arenas = arenas;
+        page->arena_reserved = reserved;
+    }
+
+    rect_copy(&page->arenas[page->arena_count++], &arena->rect);
+    page->used_area += rect_area(&arena->rect);
+    atlas_rank_page(atlas, page);
+    atlas_unlock(page);
+
+    *arena_dptr = arena;
+    return 1;
+err_reserve:
+    if (!page->backend->release(page, &arena->rect))
+        page->invalidated = 1;
+    atlas_unlock(page);
+err_space:
+    if (arena->space)
+        atlas_destroy(arena->space);
+    atlas_mem_free(&atlas->allocator, arena, sizeof(*arena));
+err_allocate:
+    return 0;
+}
+
+/**
+ * Allocates space for the virtual texture inside an arena. Arenas must only
+ * be used by one thread at a time. Fails for textures that already have space.
+ * @arg arena: Pointer to private AtlasArena structure.
+ * @arg id: Unique virtual texture identifier.
+ * @arg w: Virtual texture width.
+ * @arg h: Virtual texture height.
+ * @return: 1 on success, 0 otherwise.
+ **/
+int atlas_arena_allocate(AtlasArena *arena, uint32_t id, uint16_t w, uint16_t h)
+{
+    Atlas *atlas = arena->owner;
+    int pw = w + atlas->padding * 2, ph = h + atlas->padding * 2;
+    VirtualTexture vt;
+    if (!atlas_read_vtex(atlas, id, &vt, NULL) || rect_area(&vt.rect) != 0)
+        return 0;
+
+    // Keep track of the textures placed, retiring only walks those.
+    if (arena->texture_count == arena->texture_reserved) {
+        int reserved = arena->texture_reserved ? arena->texture_reserved * 2 : ATLAS_MIN_RESERVED_VTEXES;
+        ArenaTexture *textures = (ArenaTexture*)atlas_mem_realloc(&atlas->allocator, arena->textures,
+                                                                  sizeof(textures[0]) * arena->texture_reserved,
+                                                                  sizeof(textures[0]) * reserved);
+        if (!textures)
+            return 0;
+        arena->textures = textures;
+        arena->texture_reserved = reserved;
+    }
+
+    Rect vtex;
+    if (!arena->space->backend->allocate(arena->space, pw, ph, 0, &vtex))
+        return 0;
+
+    Rect placed = {
+        vtex.left + arena->rect.left, vtex.up + arena->rect.up,
+        vtex.right + arena->rect.left, vtex.down + arena->rect.up
+    };
+
+    atlas_lock_meta(atlas);
+    int committed = atlas_commit_vtex(atlas, id, arena->page, &placed, 0);
+    atlas_unlock_meta(atlas);
+    if (committed) {
+        arena->textures[arena->texture_count].id = id;
+        rect_copy(&arena->textures[arena->texture_count++].rect, &vtex);
+    } else {
+        arena->space->backend->release(arena->space, &vtex);
+    }
+
+    return committed;
+}
+
+/**
+ * Retires an arena, textures allocated in it stay where they are and the
+ * rest of the region goes back to its page. Should the space not be merged
+ * back cheaply, the page gets rebuilt on its next allocation.
+ * @arg arena: Pointer to private AtlasArena structure.
+ **/
+void atlas_arena_retire(AtlasArena *arena)
+{
+    Atlas *atlas = arena->owner, *page = arena->page;
+    atlas_lock(page);
+
+    int index = atlas_lookup_arena(page, &arena->rect);
+    page->arenas[index] = page->arenas[--page->arena_count];
+    page->used_area -= rect_area(&arena->rect);
+
+    // Textures destroyed meanwhile held on to their space until now. Backends
+    // adopting the arena's free rects get it released into the arena first,
+    // the others get the whole region back and take the space of the
+    // textures still living in it again.
+    Atlas *space = arena->space;
+    int adopt = page->backend->adopt != NULL;
+    if (!adopt && !page->invalidated && !page->backend->release(page, &arena->rect))
+        page->invalidated = 1;
+
+    atlas_lock_meta(atlas);
+    for (int i = 0; i < arena->texture_count; i++) {
+        ArenaTexture *texture = &arena->textures[i];
+        int slot;
+        if ((slot = atlas_lookup_vtex_id(atlas, texture->id)) == -1) {
+            if (adopt && !space->backend->release(space, &texture->rect))
+                page->invalidated = 1;
+            continue;
+        }
+
+        Rect *rect = &atlas->vtexes[slot].rect;
+        page->used_area += rect_area(rect);
+        if (!adopt && !page->invalidated && !page->backend->occupy(page, rect))
+            page->invalidated = 1;
     }
+    atlas->compact_idle = 0;
+    atlas_unlock_meta(atlas);
 
-    if (i == atlas->vtex_count)
-        return -1;
-    return i;
+    if (adopt && !page->invalidated && !page->backend->adopt(page, space, &arena->rect))
+        page->invalidated = 1;
+
+    atlas_rank_page(atlas, page);
+    atlas_unlock(page);
+
+    atlas_mem_free(&atlas->allocator, arena->textures, sizeof(arena->textures[0]) * arena->texture_reserved);
+    atlas_destroy(arena->space);
+    atlas_mem_free(&atlas->allocator, arena, sizeof(*arena));
 }
 
 /**
- * Private, look-up the smallest possible rectangle where the texture fits.
- * @arg atlas: Pointer to atlas structure.
- * @arg w: Texture width.
- * @arg h: Texture height.
- * @returns: Pointer to the hole Rect if successful, otherwise NULL.
+ * Private, fills the padded x, y, w, h of a rect.
+ * @arg rect: Pointer to the rect.
+ * @arg xywh: Pointer to retrieve (x, y) and (w, h) coordinates.
  **/
-static Rect *atlas_lookup_bestfit(Atlas *atlas, int w, int h)
+static void rect_xywh(Rect *rect, uint16_t *xywh)
 {
-    Rect *last_best = NULL;
-    uint32_t last_best_area = UINT32_MAX;
-    for (int i = 0; i < atlas->hole_count; i++) {
-        Rect *hole = &atlas->holes[i];
-        if (rect_width(hole) < w || rect_height(hole) < h)
-            continue;
-
-        uint32_t area = rect_area(hole);
-        if (area < last_best_area) {
-            last_best = hole;
-            last_best_area = area;
-        }
-    }
-
-    return last_best;
+    xywh[0] = rect->left;
+    xywh[1] = rect->up;
+    xywh[2] = rect_width(rect);
+    xywh[3] = rect_height(rect);
 }
 
 /**
- * Private, copy Rect b into a.
- * @arg a: Rect to be overwriten.
- * @arg b: Rect to be copied from, left intact.
+ * Private, moves a batch entry down a max-heap until no child has a larger
+ * key.
+ * @arg heap: Pointer to the heap entries.
+ * @arg count: Number of heap entries.
+ * @arg index: Index of the entry to move down.
  **/
-static void rect_copy(Rect *a, const Rect *b)
+static void batch_heap_sift(BatchEntry *heap, int count, int index)
 {
-    if (a == b)
-        return;
+    for (;;) {
+        int largest = index, left = index * 2 + 1, right = index * 2 + 2;
+        if (left < count && heap[left].key > heap[largest].key)
+            largest = left;
+        if (right < count && heap[right].key > heap[largest].key)
+            largest = right;
+        if (largest == index)
+            return;
 
-    a->left = b->left;
-    a->up = b->up;
-    a->right = b->right;
-    a->down = b->down;
+        BatchEntry entry = heap[index];
+        heap[index] = heap[largest];
+        heap[largest] = entry;
+        index = largest;
+    }
 }
 
 /**
- * Private, reserves more atlas holes array space.
- * @arg atlas: Pointer to atlas structure.
- * @arg reserved: Number of holes to be reserved.
- * @return: 1 on success, 0 otherwise.
+ * Private, compaction order of a virtual texture. Keys grow with the page,
+ * then the bottom and the right edge, and differ for any two textures with
+ * space allocated.
+ * @arg vt: Pointer to the virtual texture.
+ * @returns: Compaction key.
  **/
-static int atlas_reserve_holes(Atlas *atlas, int reserved)
+static uint64_t atlas_compact_key(VirtualTexture *vt)
 {
-    Rect *holes = (Rect*)realloc(atlas->holes, sizeof(holes[0]) * reserved);
-    if (!holes)
-        return 0;
-    
-    atlas->holes = holes;
-    atlas->hole_reserved = reserved;
-    return 1;
+    return ((uint64_t)vt->page << 32) | ((uint32_t)vt->rect.down << 16) | vt->rect.right;
 }
 
 /**
- * Private, reserves more atlas virtual texture array space.
+ * Private, moves virtual textures towards the first pages and the top of
+ * every page, visiting them by decreasing compaction key, starting below a
+ * cursor. Textures only move to space free at the time of the move that lies
+ * before their current position. Must hold every page lock and the meta lock.
  * @arg atlas: Pointer to atlas structure.
- * @arg reserved: Number of virtual textures to be reserved.
+ * @arg page_count: Number of pages locked.
+ * @arg cursor: Pointer to the key to start below, set past every texture
+ *              visited, or to 0 once every texture was visited.
+ * @arg max_texels: Budget of texels moved, padding included, 0 for no limit.
+ * @arg max_attempts: Textures to try moving, 0 for no limit.
+ * @arg moves: Pointer to retrieve the moves, in the order they happened.
+ * @arg max_moves: Maximum number of moves, entries in moves.
+ * @arg move_count: Pointer to retrieve the number of moves.
  * @return: 1 on success, 0 otherwise.
  **/
-static int atlas_reserve_vtexes(Atlas *atlas, int reserved)
+static int atlas_compact(Atlas *atlas, int page_count, uint64_t *cursor, uint64_t max_texels,
+                         int max_attempts, AtlasMove *moves, size_t max_moves, size_t *move_count)
 {
-    VirtualTexture *vtexes = (VirtualTexture*)realloc(atlas->vtexes, sizeof(vtexes[0]) * reserved);
-    if (!vtexes)
+    *move_count = 0;
+    size_t heap_size = sizeof(BatchEntry) * (atlas->vtex_slot_count + 1);
+    BatchEntry *heap = (BatchEntry*)atlas_mem_alloc(&atlas->allocator, heap_size);
+    if (!heap)
         return 0;
-    
-    atlas->vtexes = vtexes;
-    atlas->vtex_reserved = reserved;
+
+    // Textures in live arenas belong to the arena backend.
+    int candidates = 0;
+    for (int i = 0; i < atlas->vtex_slot_count; i++) {
+        VirtualTexture *vt = &atlas->vtexes[i];
+        if (rect_area(&vt->rect) == 0 || vt->page >= page_count || atlas_compact_key(vt) >= *cursor ||
+            atlas_lookup_arena(atlas->pages[vt->page], &vt->rect) != -1)
+            continue;
+        heap[candidates].key = atlas_compact_key(vt);
+        heap[candidates++].item = i;
+    }
+
+    // Steps only visit a few textures, a heap avoids sorting all of them.
+    for (int i = candidates / 2 - 1; i >= 0; i--)
+        batch_heap_sift(heap, candidates, i);
+
+    uint64_t moved = 0;
+    int attempts = 0;
+    while (candidates > 0) {
+        if (*move_count >= max_moves || (max_attempts && attempts >= max_attempts))
+            break;
+
+        VirtualTexture *vt = &atlas->vtexes[heap[0].item];
+        *cursor = heap[0].key;
+        heap[0] = heap[--candidates];
+        batch_heap_sift(heap, candidates, 0);
+
+        Atlas *from = atlas->pages[vt->page];
+        uint32_t area = rect_area(&vt->rect);
+        if (max_texels && moved + area > max_texels)
+            continue;
+
+        Atlas *to = NULL;
+        Rect dest;
+        attempts++;
+        for (int p = 0; p <= vt->page && !to; p++) {
+            Atlas *page = atlas->pages[p];
+            if (page->invalidated && !atlas_rebuild(page))
+                continue;
+            if (page->backend->allocate(page, rect_width(&vt->rect), rect_height(&vt->rect), 0, &dest))
+                to = page;
+        }
+        if (!to)
+            continue;
+
+        // Space further down its own page is no improvement, give it back.
+        if (to == from && (dest.up > vt->rect.up ||
+                           (dest.up == vt->rect.up && dest.left >= vt->rect.left))) {
+            if (!to->backend->release(to, &dest))
+                to->invalidated = 1;
+            continue;
+        }
+
+        AtlasMove *move = &moves[(*move_count)++];
+        Rect old = vt->rect;
+        move->id = vt->id;
+        move->old_page = from->page;
+        move->new_page = to->page;
+        rect_xywh(&old, move->old_xywh);
+        rect_xywh(&dest, move->new_xywh);
+
+        atlas_write_begin(atlas);
+        rect_copy(&vt->rect, &dest);
+        vt->page = to->page;
+        atlas_write_end(atlas);
+
+        to->used_area += area;
+        from->used_area -= area;
+        if (!from->invalidated && !from->backend->release(from, &old))
+            from->invalidated = 1;
+        moved += area;
+    }
+
+    if (candidates == 0)
+        *cursor = 0;
+    for (int i = 0; i < page_count; i++)
+        atlas_rank_page(atlas, atlas->pages[i]);
+
+    atlas_mem_free(&atlas->allocator, heap, heap_size);
     return 1;
 }
 
 /**
- * Private, resets hole count to 1 and resets first hole.
- * @arg atlas: Pointer to atlas structure.
+ * Moves virtual textures towards the first pages and the top of every page,
+ * so free space gathers in large blocks at the end. Textures are visited from
+ * the last page and the bottom up, and only moved to space free at the time
+ * of the move that lies before their current position. Moves can therefore
+ * be replayed in order, copying texels straight from old to new position.
+ * @arg atlas: Pointer to private Atlas structure.
+ * @arg max_texels: Budget of texels moved, padding included, 0 for no limit.
+ * @arg moves: Pointer to retrieve the moves, in the order they happened.
+ * @arg max_moves: Maximum number of moves, entries in moves.
+ * @arg move_count: Pointer to retrieve the number of moves.
+ * @return: 1 on success, 0 otherwise.
  **/
-static void atlas_reset_holes(Atlas *atlas)
+int atlas_defragment(Atlas *atlas, uint64_t max_texels, AtlasMove *moves, size_t max_moves,
+                     size_t *move_count)
 {
-    Rect first = {0, 0, atlas->dimensions, atlas->dimensions};
-    rect_copy(&atlas->holes[0], &first);
-    atlas->hole_count = 1;
+    uint64_t cursor = UINT64_MAX;
+    int page_count = atlas_lock_pages(atlas);
+    int success = atlas_compact(atlas, page_count, &cursor, max_texels, 0, moves, max_moves, move_count);
+    atlas_unlock_pages(atlas, page_count);
+    return success;
 }
 
 /**
- * Creates and populate atlas structure.
- * @arg atlas_ptr: Double pointer to atlas structure, undefined on failure.
- * @arg dimensions: Defines atlas width and height dimenions.
- * @arg padding: Defines padding added to all sides of a virtual texture.
+ * Runs a bounded slice of defragmentation, meant to be called once per frame.
+ * Every call resumes where the previous one stopped and tries moving at most
+ * ATLAS_COMPACT_ATTEMPTS textures, starting over once every texture was
+ * visited. Moves replay the same way as atlas_defragment ones.
+ * @arg atlas: Pointer to private Atlas structure.
+ * @arg max_texels: Budget of texels moved, padding included, 0 for no limit.
+ * @arg moves: Pointer to retrieve the moves, in the order they happened.
+ * @arg max_moves: Maximum number of moves, entries in moves.
+ * @arg move_count: Pointer to retrieve the number of moves.
  * @return: 1 on success, 0 otherwise.
  **/
-int atlas_create(Atlas **atlas_dptr, uint16_t dimensions, uint16_t padding)
+int atlas_compact_step(Atlas *atlas, uint64_t max_texels, AtlasMove *moves, size_t max_moves,
+                       size_t *move_count)
 {
-    Atlas *atlas = (Atlas*)calloc(1, sizeof(*atlas));
-    if (!atlas)
-        goto err_allocate;
-
-    // Attempt to reserve space for the necessary meta-data structures.
-    if (!atlas_reserve_holes(atlas, ATLAS_MIN_RESERVED_HOLES) || 
-        !atlas_reserve_vtexes(atlas, ATLAS_MIN_RESERVED_VTEXES))
-        goto err_reserve;
-
-    atlas->vtex_last_id = 1;
-    atlas->dimensions = dimensions;
-    atlas->padding = padding;
+    // Nothing moves until some space gets freed, skip locking every page.
+    *move_count = 0;
+    atlas_lock_meta(atlas);
+    int idle = atlas->compact_idle;
+    atlas_unlock_meta(atlas);
+    if (idle)
+        return 1;
 
-    // Initializes first hole
-    atlas_reset_holes(atlas);
+    int page_count = atlas_lock_pages(atlas);
+    if (!atlas->compact_cursor)
+        atlas->compact_cursor = UINT64_MAX;
+    int success = atlas_compact(atlas, page_count, &atlas->compact_cursor, max_texels,
+                                ATLAS_COMPACT_ATTEMPTS, moves, max_moves, move_count);
 
-    *atlas_dptr = atlas;
-    return 1;
-err_reserve:
-    atlas_destroy(atlas);
-err_allocate:
-    return 0;
-}
+    atlas->compact_moves += *move_count;
+    if (success && !atlas->compact_cursor) {
+        atlas->compact_idle = atlas->compact_moves == 0;
+        atlas->compact_moves = 0;
+    }
 
-/**
- * Free atlas and all data allocated by the atlas.
- * @arg atlas: Pointer to private Atlas structure.
- */
-void atlas_destroy(Atlas *atlas)
-{
-    if (atlas->holes)
-        free(atlas->holes);
-    if (atlas->vtexes)
-        free(atlas->vtexes);
-        
-    free(atlas);
+    atlas_unlock_pages(atlas, page_count);
+    return success;
 }
 
 /**
- * Acquires a virtual texture slot.
+ * Enlarges every page, e.g. doubling one of its sides, keeping every texture
+ * where it is and handing the new space over to the page backends. Pages can
+ * then start small and grow with the workload. Normalized coordinates follow
+ * the page size, so (u, v) and (s, t) ones must be retrieved again, and page
+ * contents copied over to the top-left of larger textures.
  * @arg atlas: Pointer to private Atlas structure.
- * @arg id_ptr: Pointer to retrieve virtual texture slot id.
- * @return: 1 on success, 0 otherwise.
+ * @arg width: New page width, at least the current one.
+ * @arg height: New page height, at least the current one.
+ * @return: 1 on success, 0 if a side would shrink or memory ran out, pages
+ *          then keep their size.
  **/
-int atlas_gen_texture(Atlas *atlas, uint32_t *id_ptr)
+int atlas_grow(Atlas *atlas, uint16_t width, uint16_t height)
 {
-    // If we don't have enough virtual texture slots reserved, attempt to double
-    // the number of reserved slots.
-    if (atlas->vtex_count >= atlas->vtex_reserved) {
-        if (!atlas_reserve_vtexes(atlas, atlas->vtex_reserved * 2)) {
-            return 0;
+    // Pages share their size, so every page is locked.
+    int page_count = atlas_lock_pages(atlas);
+
+    // Reserve for every page first, so they all grow or none does.
+    int success = width >= atlas->width && height >= atlas->height;
+    for (int i = 0; i < page_count && success; i++)
+        success = atlas->pages[i]->backend->prepare_grow(atlas->pages[i], width, height);
+
+    // Coordinate look-ups read the page size along with the texture, so
+    // they never pair a rect with the size from the other side of a grow.
+    int previous_width = atlas->width, previous_height = atlas->height;
+    if (success) {
+        atlas_write_begin(atlas);
+        for (int i = 0; i < page_count; i++) {
+            atlas_atomic_store16(&atlas->pages[i]->width, width);
+            atlas_atomic_store16(&atlas->pages[i]->height, height);
         }
+        atlas_write_end(atlas);
+        atlas->compact_idle = 0;
     }
 
-    // Acquire an unique ID and a reusable virtual texture slot.
-    VirtualTexture *vt = &atlas->vtexes[atlas->vtex_count++];
-    vt->id = atlas->vtex_last_id++;
-    vt->invalidated = 0;
-    vt->rect.left = vt->rect.up = vt->rect.right = vt->rect.down = 0;
+    for (int i = 0; i < page_count && success; i++) {
+        Atlas *page = atlas->pages[i];
+        if (!page->invalidated)
+            page->backend->grow(page, previous_width, previous_height);
+    }
 
-    *id_ptr = vt->id;
-    return 1;
+    atlas_trace_record(atlas, ATLAS_TRACE_GROW, 0, width, height, 0, success);
+    atlas_unlock_pages(atlas, page_count);
+    return success;
 }
 
 /**
- * Private, checks if two rects have any overlap.
- * @param a: Pointer to first Rect.
- * @param b: Pointer to second Rect.
- * @returns: 1 if overlaps, 0 otherwise.
+ * Serializes the atlas state into a blob: options, ids, virtual textures, and
+ * the holes or skyline of every MaxRects, Guillotine and Skyline page, which
+ * would be costly to rebuild. Blobs are versioned,
+ * stored little-endian without any pointer, and can be written out as they
+ * are. Atlases with live arenas can't be serialized.
+ * @arg atlas: Pointer to private Atlas structure.
+ * @arg blob: Pointer to the destination bytes, NULL to query the blob size.
+ * @arg size_ptr: Pointer to the destination size, retrieves the blob size.
+ * @return: 1 on success, 0 if the blob doesn't fit or can't be made.
  **/
-static int rect_overlaps(Rect *a, Rect *b)
+int atlas_serialize(Atlas *atlas, void *blob, size_t *size_ptr)
 {
-    return ((a->right > b->left) && (a->left < b->right)) &&
-           ((a->up    < b->down) && (a->down > b->up   ));
+    // Every texture must lie in a locked page.
+    int page_count = atlas_lock_pages(atlas);
+
+    int success = 0;
+    size_t size = ATLAS_BLOB_HEADER_SIZE + (size_t)atlas->vtex_slot_count * ATLAS_BLOB_VTEX_SIZE +
+                  4 + (size_t)atlas->vtex_free_count * 4;
+    for (int i = 0; i < page_count; i++) {
+        Atlas *page = atlas->pages[i];
+        if (page->arena_count || (page->invalidated && !atlas_rebuild(page)))
+            goto out;
+        size += 8 + (page->hole_left ? (size_t)page->hole_count * ATLAS_BLOB_HOLE_SIZE : 0);
+        size += page->skyline ? (size_t)page->skyline_count * ATLAS_BLOB_SEGMENT_SIZE : 0;
+    }
+
+    success = !blob || *size_ptr >= size;
+    *size_ptr = size;
+    if (!blob || !success)
+        goto out;
+
+    int backend = 0;
+    while (atlas_backends[backend] != atlas->backend)
+        backend++;
+
+    uint8_t *end = (uint8_t*)blob;
+    memcpy(end, ATLAS_BLOB_MAGIC, 4);
+    end = store_le(end + 4, ATLAS_BLOB_VERSION, 1);
+    end = store_le(end, atlas->width, 2);
+    end = store_le(end, atlas->height, 2);
+    end = store_le(end, atlas->padding, 2);
+    end = store_le(end, backend, 1);
+    end = store_le(end, atlas->heuristic, 1);
+    end = store_le(end, atlas->max_pages, 2);
+    end = store_le(end, atlas->page_order, 1);
+    end = store_le(end, atlas->concurrent, 1);
+    end = store_le(end, page_count, 2);
+    end = store_le(end, atlas->vtex_count, 4);
+    end = store_le(end, atlas->vtex_slot_count, 4);
+
+    // Every slot is kept, free ones too, as well as the order they get
+    // reused in, so ids stay valid, stale ones stay stale, and new ones come
+    // out the same.
+    for (int i = 0; i < atlas->vtex_slot_count; i++) {
+        VirtualTexture *vt = &atlas->vtexes[i];
+        end = store_le(end, vt->id, 4);
+        end = store_le(end, vt->generation, 2);
+        end = store_le(end, vt->page, 2);
+        end = store_le(end, vt->rect.left, 2);
+        end = store_le(end, vt->rect.up, 2);
+        end = store_le(end, vt->rect.right, 2);
+        end = store_le(end, vt->rect.down, 2);
+        end = store_le(end, vt->rotated, 1);
+    }
+    end = store_le(end, atlas->vtex_free_count, 4);
+    for (int i = 0; i < atlas->vtex_free_count; i++)
+        end = store_le(end, atlas->vtex_free[i], 4);
+
+    // Other backends rebuild cheaply from the textures, holes would take
+    // re-splitting for every one of them.
+    for (int i = 0; i < page_count; i++) {
+        Atlas *page = atlas->pages[i];
+        int hole_count = page->hole_left ? page->hole_count : 0;
+        end = store_le(end, hole_count, 4);
+        for (int j = 0; j < hole_count; j++) {
+            end = store_le(end, page->hole_left[j], 2);
+            end = store_le(end, page->hole_up[j], 2);
+            end = store_le(end, page->hole_right[j], 2);
+            end = store_le(end, page->hole_down[j], 2);
+        }
+
+        int skyline_count = page->skyline ? page->skyline_count : 0;
+        end = store_le(end, skyline_count, 4);
+        for (int j = 0; j < skyline_count; j++) {
+            end = store_le(end, page->skyline[j].x, 2);
+            end = store_le(end, page->skyline[j].y, 2);
+            end = store_le(end, page->skyline[j].width, 2);
+        }
+    }
+
+out:
+    atlas_unlock_pages(atlas, page_count);
+    return success;
 }
 
 /**
- * Private, checks if a is completely contained within b.
- * @param a: Pointer to first Rect.
- * @param b: Pointer to second Rect.
- * @returns: 1 if overlaps, 0 otherwise.
+ * Private, loads a rect out of a blob and checks it lies within the page.
+ * @arg bytes: Pointer to the source bytes.
+ * @arg rect: Pointer to retrieve the rect.
+ * @arg width: Page width.
+ * @arg height: Page height.
+ * @returns: Pointer past the loaded bytes, or NULL if the rect is invalid.
  **/
-static int rect_contained(Rect *a, Rect *b)
+static const uint8_t *load_rect(const uint8_t *bytes, Rect *rect, int width, int height)
 {
-    return ((a->left >= b->left) && (a->right <= b->right)) && 
-           ((a->up   >= b->up  ) && (a->down  <= b->down ));
+    uint32_t left, up, right, down;
+    bytes = load_le(bytes, &left, 2);
+    bytes = load_le(bytes, &up, 2);
+    bytes = load_le(bytes, &right, 2);
+    bytes = load_le(bytes, &down, 2);
+    if (left > right || up > down || right > (uint32_t)width || down > (uint32_t)height)
+        return NULL;
+
+    Rect loaded = {left, up, right, down};
+    rect_copy(rect, &loaded);
+    return bytes;
 }
 
 /**
- * Private, splits all atlas holes overlapped by the rectangle.
- * @param atlas: Pointer to private Atlas structure.
- * @param x: Left rectangle coordinate.
- * @param y: Top rectangle coordinate.
- * @param w: Rectangle width.
- * @param h: Rectangle height.
- * @return: 1 on success, 0 otherwise. Failure means structure is left in an invalid state.
+ * Creates an atlas out of a blob made by atlas_serialize. Holes and skylines
+ * are adopted as they are, and the blob is only read, so it can be
+ * memory-mapped.
+ * @arg atlas_dptr: Double pointer to atlas structure, undefined on failure.
+ * @arg blob: Pointer to the blob bytes.
+ * @arg size: Blob size.
+ * @return: 1 on success, 0 if the blob is invalid or memory ran out.
  **/
-static int atlas_split_holes(Atlas *atlas, Rect *cut)
+int atlas_deserialize(Atlas **atlas_dptr, const void *blob, size_t size)
 {
-    for (int i = 0; i < atlas->hole_count; i++) {
-        Rect *hole = &atlas->holes[i];
-        if (!rect_overlaps(cut, hole))
-            continue;
+    const uint8_t *at = (const uint8_t*)blob, *end = at + size;
+    uint32_t version, values[8], page_count, vtex_count, slot_count;
+    const int option_sizes[8] = {2, 2, 2, 1, 1, 2, 1, 1};
 
-        // New Rect splits to be considered for emplacing
-        Rect new_holes[4] = {
-            /* Up    */ {hole->left, hole->up,  hole->right, cut->up   },
-            /* Down  */ {hole->left, cut->down, hole->right, hole->down},
-            /* Left  */ {hole->left, hole->up,  cut->left,   hole->down},
-            /* Right */ {cut->right, hole->up,  hole->right, hole->down},
-        };
+    if (size < ATLAS_BLOB_HEADER_SIZE || memcmp(at, ATLAS_BLOB_MAGIC, 4) != 0)
+        return 0;
+    at = load_le(at + 4, &version, 1);
+    if (version != ATLAS_BLOB_VERSION)
+        return 0;
+    for (int i = 0; i < 8; i++)
+        at = load_le(at, &values[i], option_sizes[i]);
+    at = load_le(at, &page_count, 2);
+    at = load_le(at, &vtex_count, 4);
+    at = load_le(at, &slot_count, 4);
 
-        // Deallocate current hole
-        rect_copy(&atlas->holes[i], &atlas->holes[--atlas->hole_count]);
+    AtlasOptions options;
+    memset(&options, 0, sizeof(options));
+    options.dimensions = (uint16_t)values[0];
+    options.height = (uint16_t)values[1];
+    options.padding = (uint16_t)values[2];
+    options.backend = (AtlasBackend)values[3];
+    options.heuristic = (AtlasHeuristic)values[4];
+    options.max_pages = (uint16_t)values[5];
+    options.page_order = (AtlasPageOrder)values[6];
+    options.concurrent = (int)values[7];
+    if (!values[1])
+        return 0;
+    if (slot_count > (size_t)(end - at) / ATLAS_BLOB_VTEX_SIZE || slot_count > ATLAS_MAX_VTEXES ||
+        !page_count || page_count > (options.max_pages ? options.max_pages : 1u))
+        return 0;
 
-        for (int j = 0; j < 4; j++) {
-            // Skip zero area holes.
-            if (rect_area(&new_holes[j]) == 0)
-                continue;
+    Atlas *atlas;
+    if (!atlas_create_ex(&atlas, &options))
+        return 0;
 
-            // If we don't have enough hole slots, reserve more.
-            if (atlas->hole_count == atlas->hole_reserved) {
-                if (!atlas_reserve_holes(atlas, atlas->hole_reserved * 2))
-                    return 0;
-            }
+    uint32_t reserved = atlas->vtex_reserved;
+    while (reserved && reserved < slot_count)
+        reserved = atlas_grow_capacity(reserved);
+    if (!reserved || (reserved > (uint32_t)atlas->vtex_reserved && !atlas_reserve_vtexes(atlas, reserved)))
+        goto err;
+    for (uint32_t i = 1; i < page_count; i++) {
+        if (!atlas_open_page(atlas, 0))
+            goto err;
+    }
 
-            // Emplace the new hole.
-            rect_copy(&atlas->holes[atlas->hole_count++], &new_holes[j]);
-        }
+    // Live slots must hold the id of their slot and generation, free ones
+    // nothing.
+    for (uint32_t i = 0; i < slot_count; i++) {
+        VirtualTexture *vt = &atlas->vtexes[i];
+        uint32_t id, generation, page, rotated;
+        at = load_le(at, &id, 4);
+        at = load_le(at, &generation, 2);
+        at = load_le(at, &page, 2);
+        if (!(at = load_rect(at, &vt->rect, atlas->width, atlas->height)) || !generation ||
+            generation > ATLAS_MAX_GENERATION || page >= page_count)
+            goto err;
+        at = load_le(at, &rotated, 1);
+        if (id != ATLAS_INVALID_VTEX_ID && id != ((generation << ATLAS_SLOT_BITS) | i))
+            goto err;
+        if (rotated > 1 || (id == ATLAS_INVALID_VTEX_ID && (page || rotated || rect_area(&vt->rect))))
+            goto err;
 
-        // For every (j, k) pair of Rects: 
-        //      if j fully contained in k, remove j
-        // else if k fully contained in j, remove k
-        for (int j = 0; j < atlas->hole_count; j++) {
-            for (int k = j + 1; k < atlas->hole_count; k++) {
-                if (rect_contained(&atlas->holes[k], &atlas->holes[j])) {
-                    // Move last Hole index into k and drop k
-                    rect_copy(&atlas->holes[k], &atlas->holes[--atlas->hole_count]);
+        vt->id = id;
+        vt->page = page;
+        vt->generation = generation;
+        vt->rotated = rotated;
+        atlas->vtex_slot_count++;
+        atlas->vtex_count += id != ATLAS_INVALID_VTEX_ID;
+        atlas->pages[page]->used_area += rect_area(&vt->rect);
+        atlas->padding_area += rect_padding_area(&vt->rect, atlas->padding);
+    }
+    // Every free slot must be stacked exactly once, stacked slots get their
+    // page set meanwhile to catch repeats.
+    uint32_t free_count;
+    if (end - at < 4)
+        goto err;
+    at = load_le(at, &free_count, 4);
+    if ((uint32_t)atlas->vtex_count != vtex_count || free_count != slot_count - vtex_count ||
+        free_count > (size_t)(end - at) / 4)
+        goto err;
+    for (uint32_t i = 0; i < free_count; i++) {
+        uint32_t slot;
+        at = load_le(at, &slot, 4);
+        if (slot >= slot_count || atlas->vtexes[slot].id != ATLAS_INVALID_VTEX_ID || atlas->vtexes[slot].page)
+            goto err;
+        atlas->vtexes[slot].page = 1;
+        atlas->vtex_free[atlas->vtex_free_count++] = slot;
+    }
+    for (int i = 0; i < atlas->vtex_free_count; i++)
+        atlas->vtexes[atlas->vtex_free[i]].page = 0;
 
-                    // Since we moved the last Hole into k, we need to recheck the
-                    // k index instead of advancing into k+1
-                    k--;
-                } else if (rect_contained(&atlas->holes[j], &atlas->holes[k])) {
-                    // Move last Hole index into j and drop j
-                    rect_copy(&atlas->holes[j], &atlas->holes[--atlas->hole_count]);
+    for (uint32_t i = 0; i < page_count; i++) {
+        Atlas *page = atlas->pages[i];
+        uint32_t hole_count, skyline_count;
+        if (end - at < 4)
+            goto err;
+        at = load_le(at, &hole_count, 4);
+        if (hole_count > (size_t)(end - at) / ATLAS_BLOB_HOLE_SIZE || (hole_count && !page->hole_left))
+            goto err;
 
-                    // Since we moved into j, we will need to reset k now
-                    k = j + 1;
+        // Adopt the holes as they were, bucketing them again.
+        if (page->hole_left) {
+            for (int cw = 0; cw < ATLAS_SIZE_CLASSES; cw++) {
+                for (int ch = 0; ch < ATLAS_SIZE_CLASSES; ch++) {
+                    page->hole_buckets[cw][ch] = ATLAS_NIL_HOLE;
+                    page->hole_bucket_sizes[cw][ch] = 0;
                 }
             }
+            page->hole_count = 0;
         }
+        for (uint32_t j = 0; j < hole_count; j++) {
+            Rect hole;
+            if (!(at = load_rect(at, &hole, atlas->width, atlas->height)) || rect_area(&hole) == 0 ||
+                !atlas_push_hole(page, &hole))
+                goto err;
+        }
+
+        if (end - at < 4)
+            goto err;
+        at = load_le(at, &skyline_count, 4);
+        if (skyline_count > (size_t)(end - at) / ATLAS_BLOB_SEGMENT_SIZE || (skyline_count && !page->skyline) ||
+            (page->skyline && !skyline_count) ||
+            (skyline_count > (uint32_t)page->skyline_reserved && !atlas_reserve_skyline(page, skyline_count)))
+            goto err;
+
+        // Segments must cover the page width, left to right.
+        for (uint32_t j = 0, x = 0; j < skyline_count; j++) {
+            uint32_t segment[3];
+            for (int k = 0; k < 3; k++)
+                at = load_le(at, &segment[k], 2);
+            if (segment[0] != x || !segment[2] || segment[1] > atlas->height ||
+                (x += segment[2]) > atlas->width || (j + 1 == skyline_count && x != atlas->width))
+                goto err;
+
+            SkylineNode node = {segment[0], segment[1], segment[2]};
+            page->skyline[j] = node;
+        }
+        if (page->skyline)
+            page->skyline_count = skyline_count;
 
-        // Retry current hole index.
-        i--;
+        if (!page->hole_left && !page->skyline && !atlas_rebuild(page))
+            goto err;
     }
 
+    if (at != end)
+        goto err;
+    for (uint32_t i = 0; i < page_count; i++)
+        atlas_rank_page(atlas, atlas->pages[i]);
+
+    *atlas_dptr = atlas;
     return 1;
+err:
+    atlas_destroy(atlas);
+    return 0;
 }
 
 /**
- * Marks a virtual texture for future reclaiming. This happens the next time a
- * texture gets uploaded.
+ * Private, normalizes the space taken by a virtual texture copy.
  * @arg atlas: Pointer to private Atlas structure.
- * @arg id: Unique virtual texture identifier.
- * @return: 1 on success, 0 otherwise.
+ * @arg vtex: Virtual texture copy read under the vtex lock.
+ * @arg size: Page width and height read along with the copy.
+ * @arg padding: Whether to include padding.
+ * @arg uvst: Pointer to retrieve (u, v) and (s, t) normalized coordinates.
  **/
-int atlas_destroy_vtex(Atlas *atlas, uint32_t id)
+static void atlas_vtex_uvst(Atlas *atlas, const VirtualTexture *vtex, const uint16_t *size, int padding,
+                            float *uvst)
 {
-    int index;
-    if ((index = atlas_lookup_vtex_id(atlas, id)) == -1)
-        return 0;
-
-    atlas->vtexes[index].invalidated = 1;
-    atlas->holes_invalidated = 1;
+    const Rect *vt = &vtex->rect;
+    uvst[0] = (float)(vt->left ) / size[0];
+    uvst[1] = (float)(vt->up   ) / size[1];
+    uvst[2] = (float)(vt->right) / size[0];
+    uvst[3] = (float)(vt->down ) / size[1];
 
-    return 1;
+    if (!padding) {
+        float norm_padding_u = (float)atlas->padding / size[0];
+        float norm_padding_v = (float)atlas->padding / size[1];
+        uvst[0] += norm_padding_u;
+        uvst[1] += norm_padding_v;
+        uvst[2] -= norm_padding_u;
+        uvst[3] -= norm_padding_v;
+    }
 }
 
 /**
- * Allocates space for the virtual texture.
+ * Retrieves normalized texture coordinates (u, v) and (s, t) for a given unique
+ * virtual texture id, the top-left and bottom-right corners of the space it
+ * takes in its page. Rotated textures lie turned within that space.
  * @arg atlas: Pointer to private Atlas structure.
  * @arg id: Unique virtual texture identifier.
- * @arg w: Virtual texture width.
- * @arg h: Virtual texture height.
- * @return: 1 on success, 0 otherwise.
+ * @arg padding: Whether to include padding.
+ * @arg uvst: Pointer to retrieve (u, v) and (s, t) normalized coordinates.
+ * @return: 1 if virtual texture id is valid, 0 otherwise.
  **/
-int atlas_allocate_vtex_space(Atlas *atlas, uint32_t id, uint16_t w, uint16_t h)
+int atlas_get_vtex_uvst_coords(Atlas *atlas, uint32_t id, int padding, float *uvst)
 {
-    // If a texture has been deleted, we'll regenerate the holes before
-    // trying to allocate space for a new one.
-    // TODO:: Benchmark impact of this
-    if (atlas->holes_invalidated) {
-        atlas->holes_invalidated = 0;
-        atlas_reset_holes(atlas);
-
-        // Delete all invalidated textures
-        for (int i = 0; i < atlas->vtex_count; i++) {
-            VirtualTexture *vt = &atlas->vtexes[i];
-            
-            if (!vt->invalidated) {
-                // Ignore textures that haven't had space allocated for them
-                if (rect_area(&vt->rect) == 0)
-                    continue;
-
-                // If virtual texture isn't invalidated, let's reallocate space for it
-                atlas_split_holes(atlas, &vt->rect);
-            } else {
-                // Otherwise, swap current virtual texture for the last entry
-                VirtualTexture *last = &atlas->vtexes[atlas->vtex_count - 1];
-                rect_copy(&vt->rect, &last->rect);
-                vt->id = last->id;
-                vt->invalidated = last->invalidated;
-
-                // Remove last virtual texture and retry current index
-                atlas->vtex_count--;
-                i--;
-            } 
-        }
-    }
-
-    // Add padding.
-    w += atlas->padding * 2;
-    h += atlas->padding * 2;
-
-    // Look-up virtual texture id
-    VirtualTexture *vt = NULL;
-    for (int i = 0; i < atlas->vtex_count; i++) {
-        if (atlas->vtexes[i].id == id) {
-            vt = &atlas->vtexes[i];
-            break;
-        }
-    }
-
-    // If id not found, bail out
-    if (!vt)
-        return 0;
-
-    // Do a best-fit lookup
-    Rect *best_fit = atlas_lookup_bestfit(atlas, w, h);
-    if (!best_fit)
-        return 0;
-
-    // Split holes as necessary
-    Rect vtex = {
-        /* left, up    */ best_fit->left,     best_fit->up, 
-        /* right, down */ best_fit->left + w, best_fit->up + h
-    };
-
-    rect_copy(&vt->rect, &vtex);
-    if (!atlas_split_holes(atlas, &vtex))
+    VirtualTexture vtex;
+    uint16_t size[2];
+    if (!atlas_read_vtex(atlas, id, &vtex, size))
         return 0;
 
+    atlas_vtex_uvst(atlas, &vtex, size, padding, uvst);
     return 1;
 }
 
 /**
- * Retrieves normalized texture coordinates (u, v) and (s, t) for a given unique
- * virtual texture id.
+ * Retrieves normalized texture coordinates of the four corners of a virtual
+ * texture, in the order of its own top-left, top-right, bottom-right and
+ * bottom-left corners, so rotated textures map without any special case.
  * @arg atlas: Pointer to private Atlas structure.
  * @arg id: Unique virtual texture identifier.
- * @arg uvst: Pointer to retrieve (u, v) and (s, t) normalized coordinates.
+ * @arg padding: Whether to include padding.
+ * @arg uvs: Pointer to retrieve four (u, v) pairs.
  * @return: 1 if virtual texture id is valid, 0 otherwise.
  **/
-int atlas_get_vtex_uvst_coords(Atlas *atlas, uint32_t id, int padding, float *uvst)
+int atlas_get_vtex_corner_uvs(Atlas *atlas, uint32_t id, int padding, float *uvs)
 {
-    int index;
-    if ((index = atlas_lookup_vtex_id(atlas, id)) == -1)
+    VirtualTexture vtex;
+    uint16_t size[2];
+    float uvst[4];
+    if (!atlas_read_vtex(atlas, id, &vtex, size))
         return 0;
 
-    Rect *vt = &atlas->vtexes[index].rect;
-    uvst[0] = (float)(vt->left ) / atlas->dimensions;
-    uvst[1] = (float)(vt->up   ) / atlas->dimensions;
-    uvst[2] = (float)(vt->right) / atlas->dimensions;
-    uvst[3] = (float)(vt->down ) / atlas->dimensions;
-
-    if (!padding) {
-        float atlas_norm_padding = (float)atlas->padding / atlas->dimensions;
-        uvst[0] += atlas->padding / atlas_norm_padding;
-        uvst[1] += atlas->padding / atlas_norm_padding;
-        uvst[2] -= atlas->padding / atlas_norm_padding;
-        uvst[3] -= atlas->padding / atlas_norm_padding;
-    }
+    atlas_vtex_uvst(atlas, &vtex, size, padding, uvst);
+    // Turned clockwise, the top-left corner of the texture lies top-right.
+    static const int corners[2][8] = {
+        {0, 1, 2, 1, 2, 3, 0, 3},
+        {2, 1, 2, 3, 0, 3, 0, 1},
+    };
+    for (int i = 0; i < 8; i++)
+        uvs[i] = uvst[corners[vtex.rotated][i]];
 
     return 1;
 }
 
 /**
  * Retrieves texture coordinates (x, y) and (w, h) for a given unique
- * virtual texture id.
+ * virtual texture id. (w, h) is the space taken in the page, swapped from
+ * the allocated size for rotated textures.
  * @arg atlas: Pointer to private Atlas structure.
  * @arg id: Unique virtual texture identifier.
- * @arg uvst: Pointer to retrieve (x, y) and (w, h) coordinates.
+ * @arg padding: Whether to include padding.
+ * @arg xywh: Pointer to retrieve (x, y) and (w, h) coordinates.
  * @return: 1 if virtual texture id is valid, 0 otherwise.
  **/
 int atlas_get_vtex_xywh_coords(Atlas *atlas, uint32_t id, int padding, uint16_t *xywh)
 {
-    int index;
-    if ((index = atlas_lookup_vtex_id(atlas, id)) == -1)
+    VirtualTexture vtex;
+    if (!atlas_read_vtex(atlas, id, &vtex, NULL))
         return 0;
 
-    Rect *vt = &atlas->vtexes[index].rect;
+    Rect *vt = &vtex.rect;
     xywh[0] =  vt->left;
     xywh[1] =  vt->up;
     xywh[2] = (vt->right - vt->left);
@@ -499,13 +5032,33 @@ int atlas_get_vtex_xywh_coords(Atlas *atlas, uint32_t id, int padding, uint16_t
 }
 
 /**
- * Retrieves atlas dimensions.
+ * Retrieves atlas dimensions, the page width for non-square pages.
  * @arg atlas: Pointer to private Atlas structure.
  * @returns: Atlas dimensions.
  **/
 uint16_t atlas_get_dimensions(Atlas *atlas)
 {
-    return atlas->dimensions;
+    return atlas_get_width(atlas);
+}
+
+/**
+ * Retrieves atlas page width.
+ * @arg atlas: Pointer to private Atlas structure.
+ * @returns: Atlas page width.
+ **/
+uint16_t atlas_get_width(Atlas *atlas)
+{
+    return atlas->concurrent ? atlas_atomic_load16(&atlas->width) : atlas->width;
+}
+
+/**
+ * Retrieves atlas page height.
+ * @arg atlas: Pointer to private Atlas structure.
+ * @returns: Atlas page height.
+ **/
+uint16_t atlas_get_height(Atlas *atlas)
+{
+    return atlas->concurrent ? atlas_atomic_load16(&atlas->height) : atlas->height;
 }
 
 /**
@@ -516,4 +5069,108 @@ uint16_t atlas_get_dimensions(Atlas *atlas)
 uint16_t atlas_get_padding(Atlas *atlas)
 {
     return atlas->padding;
+}
+
+/**
+ * Retrieves atlas occupancy and fragmentation statistics. Areas are kept up
+ * to date as space is allocated and released, free rects are counted by the
+ * page backends, and only pages that failed to release space get rebuilt.
+ * @arg atlas: Pointer to private Atlas structure.
+ * @arg stats: Pointer to retrieve the statistics.
+ * @return: 1 on success, 0 otherwise.
+ **/
+int atlas_get_stats(Atlas *atlas, AtlasStats *stats)
+{
+    atlas_lock_meta(atlas);
+    stats->vtex_count = atlas->vtex_count;
+    stats->page_count = atlas->page_count;
+    stats->padding_area = atlas->padding_area;
+    atlas_unlock_meta(atlas);
+
+    uint64_t largest_sum = 0;
+    stats->used_area = 0;
+    stats->wasted_area = 0;
+    stats->free_area = 0;
+    stats->hole_count = 0;
+    stats->largest_free[0] = stats->largest_free[1] = 0;
+    for (uint32_t i = 0; i < stats->page_count; i++) {
+        Atlas *page = atlas->pages[i];
+        uint32_t hole_count;
+        uint16_t largest[2];
+
+        atlas_lock(page);
+        if (!atlas_validate_page(page)) {
+            atlas_unlock(page);
+            return 0;
+        }
+        // Pages grow with every page locked, so the page lock covers the size.
+        page->backend->measure(page, &hole_count, largest);
+        stats->used_area += page->used_area;
+        stats->wasted_area += page->wasted_area;
+        stats->free_area += (uint64_t)page->width * page->height - page->used_area - page->wasted_area;
+        atlas_unlock(page);
+
+        uint32_t largest_area = (uint32_t)largest[0] * largest[1];
+        if (largest_area > (uint32_t)stats->largest_free[0] * stats->largest_free[1]) {
+            stats->largest_free[0] = largest[0];
+            stats->largest_free[1] = largest[1];
+        }
+        stats->hole_count += hole_count;
+        largest_sum += largest_area;
+    }
+
+    stats->fragmentation = 0.0f;
+    if (largest_sum < stats->free_area)
+        stats->fragmentation = 1.0f - (float)((double)largest_sum / stats->free_area);
+    return 1;
+}
+
+/**
+ * Retrieves the page a virtual texture lies in, for it to be used as the
+ * layer of a texture array.
+ * @arg atlas: Pointer to private Atlas structure.
+ * @arg id: Unique virtual texture identifier.
+ * @arg page: Pointer to retrieve the page index.
+ * @return: 1 if virtual texture id is valid, 0 otherwise.
+ **/
+int atlas_get_vtex_page(Atlas *atlas, uint32_t id, uint16_t *page)
+{
+    VirtualTexture vt;
+    if (!atlas_read_vtex(atlas, id, &vt, NULL))
+        return 0;
+
+    *page = vt.page;
+    return 1;
+}
+
+/**
+ * Retrieves whether a virtual texture is stored turned 90 degrees clockwise,
+ * texel (x, y) of a (w, h) texture then lying at (h - 1 - y, x) of its space.
+ * Only textures allocated with ATLAS_ALLOCATE_ROTATE ever are.
+ * @arg atlas: Pointer to private Atlas structure.
+ * @arg id: Unique virtual texture identifier.
+ * @arg rotated: Pointer to retrieve 1 if rotated, 0 otherwise.
+ * @return: 1 if virtual texture id is valid, 0 otherwise.
+ **/
+int atlas_get_vtex_rotated(Atlas *atlas, uint32_t id, int *rotated)
+{
+    VirtualTexture vt;
+    if (!atlas_read_vtex(atlas, id, &vt, NULL))
+        return 0;
+
+    *rotated = vt.rotated;
+    return 1;
+}
+
+/**
+ * Retrieves the number of pages opened so far.
+ * @arg atlas: Pointer to private Atlas structure.
+ * @returns: Page count, at least 1.
+ **/
+uint16_t atlas_get_page_count(Atlas *atlas)
+{
+    atlas_lock_meta(atlas);
+    uint16_t page_count = atlas->page_count;
+    atlas_unlock_meta(atlas);
+    return page_count;
 }
\ No newline at end of file
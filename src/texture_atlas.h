@@ -1,21 +1,147 @@
 #ifndef __TEXTURE_ATLAS_H__
 #define __TEXTURE_ATLAS_H__
 
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
     typedef struct Atlas Atlas;
+    typedef struct AtlasArena AtlasArena;
+
+    typedef enum AtlasBackend {
+        ATLAS_BACKEND_MAXRECTS = 0, // Maximal free rectangles, best density.
+        ATLAS_BACKEND_SKYLINE,      // Skyline bottom-left, cheapest allocations.
+        ATLAS_BACKEND_GUILLOTINE,   // Disjoint guillotine cuts, cheap frees.
+        ATLAS_BACKEND_SHELF,        // Rows per height class, O(1) for uniform sizes.
+        ATLAS_BACKEND_BUDDY,        // Power-of-two quadtree blocks, O(log n).
+    } AtlasBackend;
+
+    typedef enum AtlasHeuristic {
+        ATLAS_HEURISTIC_BEST_AREA = 0,   // Smallest hole, fastest look-up.
+        ATLAS_HEURISTIC_BEST_SHORT_SIDE, // Smallest leftover on the tighter side.
+        ATLAS_HEURISTIC_BEST_LONG_SIDE,  // Smallest leftover on the looser side.
+        ATLAS_HEURISTIC_BOTTOM_LEFT,     // Topmost, then leftmost placement.
+        ATLAS_HEURISTIC_CONTACT_POINT,   // Most perimeter touching borders and textures.
+    } AtlasHeuristic;
+
+    typedef enum AtlasSortOrder {
+        ATLAS_SORT_NONE = 0,  // Arrival order.
+        ATLAS_SORT_MAX_SIDE,  // Longest side first, then shortest side.
+        ATLAS_SORT_AREA,      // Largest area first.
+        ATLAS_SORT_PERIMETER, // Largest perimeter first.
+    } AtlasSortOrder;
+
+    typedef enum AtlasAllocateFlags {
+        ATLAS_ALLOCATE_ROTATE = 1 << 0, // Allow storing the texture turned 90 degrees clockwise,
+                                        // MaxRects, Guillotine and Skyline only.
+    } AtlasAllocateFlags;
+
+    typedef enum AtlasPageOrder {
+        ATLAS_PAGES_FIRST_FIT = 0, // Oldest page first.
+        ATLAS_PAGES_FULLEST_FIRST, // Most used page first, newer pages stay emptier.
+    } AtlasPageOrder;
+
+    /**
+     * Metadata allocation callbacks. realloc may be NULL, blocks then get
+     * copied over. Sizes given back are the ones blocks were allocated with.
+     * Concurrent atlases call them from several threads at once.
+     **/
+    typedef struct AtlasAllocator {
+        void *(*alloc)(size_t size, void *user);
+        void *(*realloc)(void *ptr, size_t old_size, size_t size, void *user);
+        void (*free)(void *ptr, size_t size, void *user);
+        void *user;
+    } AtlasAllocator;
+
+    typedef struct AtlasOptions {
+        uint16_t dimensions;       // Atlas page width, and height unless set below.
+        uint16_t padding;          // Padding added to all sides of a virtual texture.
+        AtlasBackend backend;      // Packing algorithm used to place virtual textures.
+        AtlasHeuristic heuristic;  // Hole choice, MaxRects and Guillotine only.
+        uint16_t max_pages;        // Pages to spill over to, 0 or 1 for a single page.
+        AtlasPageOrder page_order; // Order existing pages are tried in.
+        int concurrent;            // Allow use from several threads, first fit pages only.
+        const AtlasAllocator *allocator; // Metadata allocations, NULL for the C library.
+        void *buffer;              // Fixed memory holding all metadata, NULL to allocate it.
+        size_t buffer_size;        // Size of buffer in bytes.
+        uint16_t height;           // Atlas page height, 0 for square pages.
+    } AtlasOptions;
+
+    typedef struct AtlasStats {
+        uint32_t vtex_count;       // Virtual textures currently generated.
+        uint32_t page_count;       // Pages opened so far.
+        uint64_t used_area;        // Area allocated to virtual textures and live arenas, padding included.
+        uint64_t wasted_area;      // Area reserved past the requests, e.g. buddy rounding.
+        uint64_t padding_area;     // Part of the used area taken by virtual texture padding.
+        uint64_t free_area;        // Area of opened pages neither used nor wasted.
+        uint32_t hole_count;       // Free rects tracked by the backends of every page.
+        uint16_t largest_free[2];  // Width and height of the largest free rect on any page.
+        float fragmentation;       // Share of the free area outside of the largest rect of each page.
+    } AtlasStats;
+
+    typedef struct AtlasMove {
+        uint32_t id;          // Virtual texture moved.
+        uint16_t old_page;    // Page it was moved out of.
+        uint16_t new_page;    // Page it was moved into.
+        uint16_t old_xywh[4]; // Previous (x, y) and (w, h), padding included.
+        uint16_t new_xywh[4]; // New (x, y) and (w, h), padding included.
+    } AtlasMove;
+
+    /**
+     * Traces start with ATLAS_TRACE_MAGIC and an ATLAS_TRACE_VERSION byte,
+     * followed by records: an op byte, then the fields listed below stored
+     * little-endian, ids as 32 bits, sizes as 16 bits and results as 8 bits.
+     **/
+#define ATLAS_TRACE_MAGIC "ATLT"
+#define ATLAS_TRACE_VERSION 3
+
+    typedef enum AtlasTraceOp {
+        ATLAS_TRACE_CREATE = 0,  // dimensions, padding, backend (8 bits), heuristic (8 bits),
+                                 // max_pages, page_order (8 bits), concurrent (8 bits),
+                                 // height since version 3.
+        ATLAS_TRACE_GEN,         // id.
+        ATLAS_TRACE_ALLOCATE,    // id, w, h, result.
+        ATLAS_TRACE_DESTROY,     // id.
+        ATLAS_TRACE_ALLOCATE_EX, // id, w, h, flags (8 bits), result. Since version 2.
+        ATLAS_TRACE_GROW,        // width, height, result, no id. Since version 3.
+    } AtlasTraceOp;
+
+    typedef void (*AtlasTraceWrite)(const void *data, size_t size, void *user);
 
     extern int atlas_create(Atlas **atlas_dptr, uint16_t dimensions, uint16_t padding);
+    extern int atlas_trace(Atlas *atlas, AtlasTraceWrite write, void *user);
+    extern int atlas_create_ex(Atlas **atlas_dptr, const AtlasOptions *options);
     extern void atlas_destroy(Atlas *atlas);
     extern int atlas_gen_texture(Atlas *atlas, uint32_t *id_ptr);
     extern int atlas_destroy_vtex(Atlas *atlas, uint32_t id);
     extern int atlas_allocate_vtex_space(Atlas *atlas, uint32_t id, uint16_t w, uint16_t h);
+    extern int atlas_allocate_vtex_space_ex(Atlas *atlas, uint32_t id, uint16_t w, uint16_t h, uint32_t flags);
+    extern int atlas_allocate_batch(Atlas *atlas, const uint32_t *ids, const uint16_t *wh, size_t n,
+                                    AtlasSortOrder order, uint8_t *results);
+    extern int atlas_arena_create(Atlas *atlas, uint16_t dimensions, AtlasArena **arena_dptr);
+    extern int atlas_arena_allocate(AtlasArena *arena, uint32_t id, uint16_t w, uint16_t h);
+    extern void atlas_arena_retire(AtlasArena *arena);
+    extern int atlas_grow(Atlas *atlas, uint16_t width, uint16_t height);
+    extern int atlas_defragment(Atlas *atlas, uint64_t max_texels, AtlasMove *moves, size_t max_moves,
+                                size_t *move_count);
+    extern int atlas_compact_step(Atlas *atlas, uint64_t max_texels, AtlasMove *moves, size_t max_moves,
+                                  size_t *move_count);
+    extern int atlas_serialize(Atlas *atlas, void *blob, size_t *size_ptr);
+    extern int atlas_deserialize(Atlas **atlas_dptr, const void *blob, size_t size);
     extern int atlas_get_vtex_uvst_coords(Atlas *atlas, uint32_t id, int padding, float *uvst);
     extern int atlas_get_vtex_xywh_coords(Atlas *atlas, uint32_t id, int padding, uint16_t *xywh);
+    extern int atlas_get_vtex_corner_uvs(Atlas *atlas, uint32_t id, int padding, float *uvs);
+    extern int atlas_get_vtex_rotated(Atlas *atlas, uint32_t id, int *rotated);
     extern uint16_t atlas_get_dimensions(Atlas *atlas);
+    extern uint16_t atlas_get_width(Atlas *atlas);
+    extern uint16_t atlas_get_height(Atlas *atlas);
     extern uint16_t atlas_get_padding(Atlas *atlas);
+    extern int atlas_get_stats(Atlas *atlas, AtlasStats *stats);
+    extern int atlas_get_vtex_page(Atlas *atlas, uint32_t id, uint16_t *page);
+    extern uint16_t atlas_get_page_count(Atlas *atlas);
 #ifdef __cplusplus
 }
 #endif